@@ -11,6 +11,8 @@ import threading
 import shlex
 import random
 import json
+import struct
+import ctypes
 
 VERSION  = "0.21"
 REVISION = "a"
@@ -18,6 +20,9 @@ VER_DATE = "20171209"
 
 VISIBLE_BOARD = True
 TIME_LIMIT = 1000.0
+BINARY_PROTOCOL = False  # offered to the players at init (--binary)
+RULES_BACKEND = "python"  # "python", "native" or "check" (--rules)
+RULES_LIBRARY = os.path.join(os.path.dirname(os.path.abspath(__file__)), "libqrrules.so")
 
 BLACK_DISC = "o"
 WHITE_DISC = "x"
@@ -26,7 +31,91 @@ EMPTY_DISC = "_"
 DISPLAY_DISCS = {x: x for x in (BLACK_DISC, WHITE_DISC, QUANTUM_DISC, EMPTY_DISC)}
 #DISPLAY_DISCS = {BLACK_DISC: "\u25cf", WHITE_DISC: "\u25cb", QUANTUM_DISC: "\u269b", EMPTY_DISC: "\u2423"}
 
-def read_response(player, player_time):
+# binary protocol frames (see src/binary_protocol.hpp)
+BINARY_ACTIONS = {"init": 1, "play": 2, "select": 3, "quit": 4}
+REQUEST_FRAME = struct.Struct("<HBBBBBBQQ36H")
+RESPONSE_FRAME = struct.Struct("<HBBBBH")
+
+def encode_request(data, size):
+    """encode a message as a binary request frame
+    """
+    board = data.get("board", [])
+    black = sum(1 << i for i, c in enumerate(board) if c == BLACK_DISC)
+    white = sum(1 << i for i, c in enumerate(board) if c == WHITE_DISC)
+    moves = [q[0] | (q[1] << 6) | ((s >= 0) << 12) | ((s > 0) << 13) for q, s in data.get("moves", [])]
+    ent = data.get("entanglement", (0, 0))
+    return REQUEST_FRAME.pack(REQUEST_FRAME.size, BINARY_ACTIONS[data["action"]], len(moves), ent[0], ent[1], data.get("index", 0), 0, black, white, *(moves + [0] * (size - len(moves))))
+
+def decode_response(response):
+    """decode a binary response frame into the fields of a JSON response
+    """
+    length, action, p, q, select, _ = RESPONSE_FRAME.unpack(response)
+    return {"positions": [p, q], "select": select}
+
+class RulesMismatch(Exception):
+    """the Python and native rules disagree
+    """
+    pass
+
+class NativeRules:
+    """rules of src/qr_rules.cpp loaded through ctypes
+    """
+    def __init__(self, path, size):
+        self.size = size
+        self.lib = ctypes.CDLL(path)
+        self.lib.qr_rules_create.restype = ctypes.c_void_p
+        self.lib.qr_rules_create.argtypes = []
+        self.lib.qr_rules_destroy.argtypes = [ctypes.c_void_p]
+        self.lib.qr_rules_play.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int]
+        self.lib.qr_rules_select.argtypes = [ctypes.c_void_p, ctypes.c_int]
+        self.lib.qr_rules_board.argtypes = [ctypes.c_void_p] + [ctypes.POINTER(ctypes.c_uint64)] * 3
+        self.lib.qr_rules_moves.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_uint16), ctypes.c_int]
+        self.lib.qr_rules_entanglement.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_int), ctypes.c_int]
+        self.handle = self.lib.qr_rules_create()
+        if not self.handle:
+            raise MemoryError("qr_rules_create failed")
+
+    def __del__(self):
+        if getattr(self, "handle", None):
+            self.lib.qr_rules_destroy(self.handle)
+            self.handle = None
+
+    def play(self, pos1, pos2):
+        """returns 1 for a cycle, 0 for a plain move and < 0 for an invalid one
+        """
+        return self.lib.qr_rules_play(self.handle, pos1, pos2)
+
+    def select(self, pos):
+        return self.lib.qr_rules_select(self.handle, pos) == 0
+
+    def board(self):
+        black, white, quantum = ctypes.c_uint64(), ctypes.c_uint64(), ctypes.c_uint64()
+        self.lib.qr_rules_board(self.handle, ctypes.byref(black), ctypes.byref(white), ctypes.byref(quantum))
+        board = []
+        for pos in range(self.size):
+            bit = 1 << pos
+            if black.value & bit:
+                board.append(BLACK_DISC)
+            elif white.value & bit:
+                board.append(WHITE_DISC)
+            elif quantum.value & bit:
+                board.append(QUANTUM_DISC)
+            else:
+                board.append(EMPTY_DISC)
+        return board
+
+    def moves(self):
+        buf = (ctypes.c_uint16 * 64)()
+        n = self.lib.qr_rules_moves(self.handle, buf, len(buf))
+        return [[(x & 63, (x >> 6) & 63), (x >> 13) & 1 if x & (1 << 12) else -1] for x in buf[:n]]
+
+    def entanglement(self):
+        buf = (ctypes.c_int * 64)()
+        n = self.lib.qr_rules_entanglement(self.handle, buf, len(buf))
+        moves = self.moves()
+        return [(idx, moves[idx][0]) for idx in buf[:n]]
+
+def read_response(player, player_time, binary=False):
     start_time = time.time()
     class ExecThread(threading.Thread):
         def __init__(self, player):
@@ -34,7 +123,10 @@ def read_response(player, player_time):
             self.response = None
             threading.Thread.__init__(self)
         def run(self):
-            self.response = self.player.stdout.readline().strip()
+            if binary:
+                self.response = self.player.stdout.read(RESPONSE_FRAME.size)
+            else:
+                self.response = self.player.stdout.readline().strip()
         def get_response(self):
             return self.response
     t = ExecThread(player)
@@ -50,12 +142,15 @@ def check_TLE(players, name, player_time):
         return True
     return False
 
-def quit_game(players, player_times):
+def quit_game(players, player_times, binary=(False, False)):
     for idx in range(2):
         try:
-            players[idx].stdin.write(("%s\n" % json.dumps({"action": "quit"})).encode("utf-8"))
+            if binary[idx]:
+                players[idx].stdin.write(encode_request({"action": "quit"}, 36))
+            else:
+                players[idx].stdin.write(("%s\n" % json.dumps({"action": "quit"})).encode("utf-8"))
             players[idx].stdin.flush()
-            response, player_times[idx] = read_response(players[idx], player_times[idx])
+            response, player_times[idx] = read_response(players[idx], player_times[idx], binary[idx])
         except:
             pass
 
@@ -75,6 +170,8 @@ class QuantumReversi:
         self.solvers = []
         self.names = []
         self.entanglement = []
+        self.binary = [False, False]
+        self.native = NativeRules(RULES_LIBRARY, self.w * self.h) if RULES_BACKEND != "python" else None
         for name, solver in self.players:
             self.solvers.append(subprocess.Popen(solver, shell=True, stdin=subprocess.PIPE, stdout=subprocess.PIPE))
             self.names.append(name)
@@ -93,23 +190,48 @@ class QuantumReversi:
         self.board[self.xy2pos(x  , y+1)] = BLACK_DISC
         self.board[self.xy2pos(x+1, y+1)] = WHITE_DISC
 
+    def send(self, idx, data):
+        """send a message to a player in its negotiated protocol
+        """
+        if self.binary[idx]:
+            self.solvers[idx].stdin.write(encode_request(data, self.size))
+        else:
+            self.solvers[idx].stdin.write(("%s\n" % json.dumps(data)).encode("utf-8"))
+        self.solvers[idx].stdin.flush()
+
+    def receive(self, idx):
+        """receive a response from a player and update its time
+        """
+        response, self.player_times[idx] = read_response(self.solvers[idx], self.player_times[idx], self.binary[idx])
+        return response
+
+    def parse_response(self, idx, response):
+        """parse a response in the player's protocol
+        """
+        if self.binary[idx]:
+            return decode_response(response)
+        return json.loads(response.decode("utf-8"))
+
     def initialize(self):
         for idx in range(2):
             try:
-                data = json.dumps({"action": "init", "index": idx, "names": self.names, "size": (self.w, self.h), "board": self.board, "moves": self.moves, "black": BLACK_DISC, "white": WHITE_DISC, "quantum": QUANTUM_DISC, "empty": EMPTY_DISC})
-                self.solvers[idx].stdin.write(("%s\n" % data).encode("utf-8"))
-                self.solvers[idx].stdin.flush()
-                response, self.player_times[idx] = read_response(self.solvers[idx], self.player_times[idx])
+                data = {"action": "init", "index": idx, "names": self.names, "size": (self.w, self.h), "board": self.board, "moves": self.moves, "black": BLACK_DISC, "white": WHITE_DISC, "quantum": QUANTUM_DISC, "empty": EMPTY_DISC}
+                if BINARY_PROTOCOL:
+                    data["protocol"] = "binary"
+                self.send(idx, data)
+                response = self.receive(idx)
                 if check_TLE(self.solvers, self.names[idx], self.player_times[idx]):
                     self.winner = idx^1
                     self.msg = "%s's program got time limit exceeded" % self.names[idx]
                     tle_player = (idx, self.names[idx])
-                    quit_game(self.solvers, self.player_times)
+                    quit_game(self.solvers, self.player_times, self.binary)
                     return False
+                if BINARY_PROTOCOL and response:
+                    self.binary[idx] = json.loads(response.decode("utf-8")).get("protocol") == "binary"
             except Exception as e:
                 self.winner = idx^1
                 self.msg = "%s's program was stopped in the init command: %s" % (self.names[idx], str(e))
-                quit_game(self.solvers, self.player_times)
+                quit_game(self.solvers, self.player_times, self.binary)
                 return False
         return True
 
@@ -119,47 +241,48 @@ class QuantumReversi:
         idx = 0
         while self.board.count(BLACK_DISC) + self.board.count(WHITE_DISC) < self.w * self.h:
             try:
-                data = json.dumps({"action": "play", "board": self.board, "moves": self.moves})
-                self.solvers[idx].stdin.write(("%s\n" % data).encode("utf-8"))
-                self.solvers[idx].stdin.flush()
-                response, self.player_times[idx] = read_response(self.solvers[idx], self.player_times[idx])
+                self.send(idx, {"action": "play", "board": self.board, "moves": self.moves})
+                response = self.receive(idx)
                 if check_TLE(self.solvers, self.names[idx], self.player_times[idx]):
                     self.winner = idx^1
                     self.msg = "%s's program got time limit exceeded" % self.names[idx]
                     tle_player = (idx, self.names[idx])
-                    quit_game(self.solvers, self.player_times)
+                    quit_game(self.solvers, self.player_times, self.binary)
                     return
-                data = json.loads(response.decode("utf-8"))
+                data = self.parse_response(idx, response)
                 pos1, pos2 = map(int, data["positions"])
                 cyclic = self.move(pos1, pos2)
                 if cyclic == False:
                     self.winner = idx^1
                     self.msg = "{}'s program moved invalid position: {}".format(self.names[idx], (pos1, pos2))
                     tle_player = (idx, self.names[idx])
-                    quit_game(self.solvers, self.player_times)
+                    quit_game(self.solvers, self.player_times, self.binary)
                     return
                 if cyclic:
                     self.entangle(cyclic)  # update entanglement
+                self.check_rules()
                 idx ^= 1
                 if self.entanglement:
                     _, qvalues = self.entanglement[0]
-                    data = json.dumps({"action": "select", "entanglement": qvalues, "board": self.board, "moves": self.moves})
-                    self.solvers[idx].stdin.write(("%s\n" % data).encode("utf-8"))
-                    self.solvers[idx].stdin.flush()
-                    response, self.player_times[idx] = read_response(self.solvers[idx], self.player_times[idx])
+                    self.send(idx, {"action": "select", "entanglement": qvalues, "board": self.board, "moves": self.moves})
+                    response = self.receive(idx)
                     if check_TLE(self.solvers, self.names[idx], self.player_times[idx]):
                         self.winner = idx^1
                         self.msg = "%s's program got time limit exceeded" % self.names[idx]
                         tle_player = (idx, self.names[idx])
-                        quit_game(self.solvers, self.player_times)
+                        quit_game(self.solvers, self.player_times, self.binary)
                         return
-                    data = json.loads(response.decode("utf-8"))
+                    data = self.parse_response(idx, response)
                     self.select(qvalues.index(int(data["select"])))
+                    self.check_rules(collapsed=True)
 
+            except RulesMismatch:
+                quit_game(self.solvers, self.player_times, self.binary)
+                raise
             except Exception as e:
                 self.winner = idx^1
                 self.msg = "%s's program was stopped in the play command: %s" % (self.names[idx], str(e))
-                quit_game(self.solvers, self.player_times)
+                quit_game(self.solvers, self.player_times, self.binary)
                 return
 
             if VISIBLE_BOARD:
@@ -167,7 +290,7 @@ class QuantumReversi:
                 print()
 
             self.entanglement = []
-        quit_game(self.solvers, self.player_times)
+        quit_game(self.solvers, self.player_times, self.binary)
 
     def pos2xy(self, idx):
         """convert position to xy (2-tuple)
@@ -183,7 +306,14 @@ class QuantumReversi:
         """set superposition on the board
         """
         qs = sorted([pos if type(pos) == int else self.xy2pos(pos[0], pos[1]) for pos in (pos1, pos2)])
-        if not self.validate(qs):
+        if RULES_BACKEND == "native":
+            return self.move_native(qs)
+        valid = self.validate(qs)
+        if RULES_BACKEND == "check":
+            result = self.native.play(qs[0], qs[1]) if len(qs) == 2 else -1
+            if valid != (result >= 0):
+                raise RulesMismatch("move {}: valid {} (python) vs {} (native)".format(tuple(qs), valid, result >= 0))
+        if not valid:
             print("Error: invalid positions", file=sys.stderr)
             return False
         for pos in qs:
@@ -192,7 +322,38 @@ class QuantumReversi:
             self.moves.append([tuple(qs), -1])
         self.player ^= 1
         self.turn += 1
-        return self.evaluate(tuple(qs))
+        cyclic = self.evaluate(tuple(qs))
+        if RULES_BACKEND == "check" and bool(cyclic) != (result == 1):
+            raise RulesMismatch("move {}: cycle {} (python) vs {} (native)".format(tuple(qs), bool(cyclic), result == 1))
+        return cyclic
+
+    def move_native(self, qs):
+        """set superposition on the board with the native rules
+        """
+        if len(qs) != 2:
+            print("Error: invalid positions", file=sys.stderr)
+            return False
+        result = self.native.play(qs[0], qs[1])
+        if result < 0:
+            print("Error: invalid positions", file=sys.stderr)
+            return False
+        self.board = self.native.board()
+        self.moves = self.native.moves()
+        self.player ^= 1
+        self.turn += 1
+        return True if result == 1 else None  # False means an invalid move
+
+    def check_rules(self, collapsed=False):
+        """compare the state of both rule implementations
+        """
+        if RULES_BACKEND != "check":
+            return
+        checks = [("board", self.board, self.native.board()), ("moves", self.moves, self.native.moves())]
+        if not collapsed:  # self.entanglement is kept until the board is shown
+            checks.append(("entanglement", self.entanglement, self.native.entanglement()))
+        for name, python, native in checks:
+            if python != native:
+                raise RulesMismatch("step {}: {} differs\n  python: {}\n  native: {}".format(len(self.moves), name, python, native))
 
     def validate(self, qs):
         """validate positions of discs on the board
@@ -266,6 +427,13 @@ class QuantumReversi:
         if not self.entanglement:
             return False
         idx, qvalues = self.entanglement[0]
+        if RULES_BACKEND != "python":
+            if not self.native.select(qvalues[pos]):
+                return False
+            if RULES_BACKEND == "native":
+                self.board = self.native.board()
+                self.moves = self.native.moves()
+                return True
         self.moves[idx][1] = pos  # 0 or 1
         check = [qvalues[self.moves[idx][1]]]
         self.board[self.moves[idx][0][self.moves[idx][1]]] = (BLACK_DISC, WHITE_DISC)[idx&1]
@@ -289,6 +457,9 @@ class QuantumReversi:
     def entangle(self, cyclic):
         """check cyclic entanglements and collapse to classical values
         """
+        if RULES_BACKEND == "native":
+            self.entanglement = self.native.entanglement()
+            return
         paths = []
         entireties = cyclic[:]  # classical values
         for i in range(len(entireties) - 1):
@@ -361,12 +532,27 @@ class QuantumReversi:
                 print("### Draw game")
 
 def main(args):
-    if len(args) < 5:
-        print("Usage: %s name1 command1 name2 command2" % os.path.basename(args[0]), file=sys.stderr)
+    global BINARY_PROTOCOL, RULES_BACKEND, RULES_LIBRARY
+    if "--binary" in args:
+        BINARY_PROTOCOL = True
+        args = [a for a in args if a != "--binary"]
+    for option in ("--rules", "--rules-lib"):
+        if option in args[:-1]:
+            i = args.index(option)
+            if option == "--rules":
+                RULES_BACKEND = args[i + 1]
+            else:
+                RULES_LIBRARY = args[i + 1]
+            args = args[:i] + args[i+2:]
+    if len(args) < 5 or RULES_BACKEND not in ("python", "native", "check"):
+        print("Usage: %s [--binary] [--rules python|native|check] [--rules-lib path] name1 command1 name2 command2" % os.path.basename(args[0]), file=sys.stderr)
         print("  name1    : first player's name", file=sys.stderr)
         print("  command1 : first player's command", file=sys.stderr)
         print("  name2    : second player's name", file=sys.stderr)
         print("  command2 : second player's command", file=sys.stderr)
+        print("  --binary : offer the binary protocol to the players", file=sys.stderr)
+        print("  --rules  : rules implementation; check runs both and compares them on every move", file=sys.stderr)
+        print("  --rules-lib : path of libqrrules.so (default: next to this script)", file=sys.stderr)
         sys.exit(1)
 
     players = [(name, solver) for name, solver in zip(args[1:4:2], args[2:5:2])]
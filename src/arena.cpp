@@ -0,0 +1,735 @@
+// Native match runner playing many games between two engines in parallel
+// g++ src/arena.cpp -std=c++14 -O3 -pthread -o arena
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <map>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include "state.hpp"
+#include "game_tracker.hpp"
+#include "binary_protocol.hpp"
+#include "sprt.hpp"
+
+struct ArenaOptions {
+	int num_games = 100;
+	int num_threads = static_cast<int>(std::thread::hardware_concurrency());
+	double time_limit = 1000.0;  // per player and game, as in quantum_reversi.py
+	bool binary = false;         // offer the binary protocol at init
+	bool verbose = false;        // keep the engines' stderr
+	const char *openings = nullptr;  // file of opening move lists
+	int random_plies = 0;        // random opening length when no file is given
+	uint32_t seed = 1;           // for random openings
+	bool sprt = false;           // stop as soon as the SPRT decides
+	double elo0 = 0.0, elo1 = 5.0;
+	double alpha = 0.05, beta = 0.05;
+};
+
+typedef std::vector<std::pair<int, int>> Opening;
+
+// quantum moves never occupy cells, so the 32 empty cells of the initial
+// position take at most 31 moves before every further move closes a cycle
+static constexpr int MAX_RANDOM_PLIES = 31;
+// draws per ply before a random opening gives up
+static constexpr int MAX_OPENING_TRIES = 100000;
+
+// An opening is a line of pairs "p,q" played after the initial stones, for
+// example "8,27 9,22". Openings must not close a cycle.
+static bool is_valid_opening(const Opening& opening){
+	GameTracker tracker;
+	for(const auto& m : opening){
+		if(!tracker.play(m.first, m.second) || tracker.has_pending()){ return false; }
+	}
+	return true;
+}
+
+static bool load_openings(const char *path, std::vector<Opening>& openings){
+	std::ifstream ifs(path);
+	if(!ifs){ return false; }
+	std::string line;
+	while(std::getline(ifs, line)){
+		if(line.empty() || line[0] == '#'){ continue; }
+		for(auto& c : line){ if(c == ','){ c = ' '; } }
+		std::istringstream iss(line);
+		Opening opening;
+		int p, q;
+		while(iss >> p >> q){ opening.emplace_back(p, q); }
+		if(opening.empty()){ continue; }
+		if(!is_valid_opening(opening)){
+			std::cerr << "invalid opening: " << line << std::endl;
+			return false;
+		}
+		openings.push_back(opening);
+	}
+	return !openings.empty();
+}
+
+// `plies` random moves without cycles; shorter if they could not be found
+static Opening random_opening(int plies, uint32_t seed){
+	std::mt19937 engine(seed);
+	GameTracker tracker;
+	Opening opening;
+	int tries = 0;
+	while(static_cast<int>(opening.size()) < plies){
+		if(++tries > MAX_OPENING_TRIES){ break; }
+		const auto& board = tracker.state().classic_board();
+		std::vector<int> cells;
+		for(int i = 0; i < 36; ++i){
+			if(!board.get(i)){ cells.push_back(i); }
+		}
+		const int p = cells[engine() % cells.size()];
+		const int q = cells[engine() % cells.size()];
+		if(p == q || tracker.state().test_entanglement(std::min(p, q), std::max(p, q))){
+			continue;
+		}
+		tracker.play(p, q);
+		opening.emplace_back(std::min(p, q), std::max(p, q));
+		tries = 0;
+	}
+	return opening;
+}
+
+// An engine running in a child process connected by pipes. Reads wait on
+// an epoll instance so that every read has a deadline.
+class EngineProcess {
+
+private:
+	pid_t m_pid;
+	int m_in;      // engine's stdin
+	int m_out;     // engine's stdout
+	int m_epoll;
+	std::string m_buffer;
+
+	// waits until m_out is readable or the deadline passes
+	bool wait_readable(const std::chrono::steady_clock::time_point& deadline){
+		while(true){
+			const auto now = std::chrono::steady_clock::now();
+			if(now >= deadline){ return false; }
+			const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+				deadline - now).count() + 1;
+			epoll_event ev;
+			const int n = epoll_wait(m_epoll, &ev, 1, static_cast<int>(ms));
+			if(n > 0){ return true; }
+			if(n < 0 && errno != EINTR){ return false; }
+		}
+	}
+
+	// appends what is available to m_buffer; false on EOF or error
+	bool fill(const std::chrono::steady_clock::time_point& deadline){
+		if(!wait_readable(deadline)){ return false; }
+		char buf[4096];
+		ssize_t n;
+		do { n = read(m_out, buf, sizeof(buf)); } while(n < 0 && errno == EINTR);
+		if(n <= 0){ return false; }
+		m_buffer.append(buf, n);
+		return true;
+	}
+
+public:
+	EngineProcess()
+		: m_pid(-1)
+		, m_in(-1)
+		, m_out(-1)
+		, m_epoll(-1)
+		, m_buffer()
+	{ }
+
+	EngineProcess(const EngineProcess&) = delete;
+	EngineProcess& operator=(const EngineProcess&) = delete;
+
+	~EngineProcess(){ stop(); }
+
+	// runs `command` with /bin/sh in its own process group
+	bool start(const std::string& command, bool keep_stderr){
+		int to_engine[2], from_engine[2];
+		if(pipe2(to_engine, O_CLOEXEC) != 0){ return false; }
+		if(pipe2(from_engine, O_CLOEXEC) != 0){
+			close(to_engine[0]);
+			close(to_engine[1]);
+			return false;
+		}
+		const std::string script = "exec " + command;
+		const pid_t pid = fork();
+		if(pid == 0){
+			setpgid(0, 0);
+			dup2(to_engine[0], 0);
+			dup2(from_engine[1], 1);
+			if(!keep_stderr){
+				const int null = open("/dev/null", O_WRONLY);
+				if(null >= 0){ dup2(null, 2); }
+			}
+			execl("/bin/sh", "sh", "-c", script.c_str(), static_cast<char *>(nullptr));
+			_exit(127);
+		}
+		close(to_engine[0]);
+		close(from_engine[1]);
+		m_in = to_engine[1];
+		m_out = from_engine[0];
+		if(pid < 0){
+			stop();
+			return false;
+		}
+		m_pid = pid;
+		m_epoll = epoll_create1(EPOLL_CLOEXEC);
+		epoll_event ev = epoll_event();
+		ev.events = EPOLLIN;
+		ev.data.fd = m_out;
+		if(m_epoll < 0 || epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_out, &ev) != 0){
+			stop();
+			return false;
+		}
+		return true;
+	}
+
+	bool write_all(const void *data, size_t size){
+		const char *p = static_cast<const char *>(data);
+		while(size > 0){
+			const ssize_t n = write(m_in, p, size);
+			if(n < 0 && errno == EINTR){ continue; }
+			if(n <= 0){ return false; }
+			p += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	bool write_line(const std::string& line){
+		return write_all(line.data(), line.size()) && write_all("\n", 1);
+	}
+
+	// one line without its terminator; false on timeout or EOF
+	bool read_line(std::string& line, const std::chrono::steady_clock::time_point& deadline){
+		while(true){
+			const auto pos = m_buffer.find('\n');
+			if(pos != std::string::npos){
+				line.assign(m_buffer, 0, pos);
+				m_buffer.erase(0, pos + 1);
+				if(!line.empty() && line.back() == '\r'){ line.pop_back(); }
+				return true;
+			}
+			if(!fill(deadline)){ return false; }
+		}
+	}
+
+	bool read_bytes(void *data, size_t size, const std::chrono::steady_clock::time_point& deadline){
+		while(m_buffer.size() < size){
+			if(!fill(deadline)){ return false; }
+		}
+		memcpy(data, m_buffer.data(), size);
+		m_buffer.erase(0, size);
+		return true;
+	}
+
+	// closes the pipes, kills the process group if it does not exit by
+	// itself shortly and reaps the child
+	void stop(){
+		if(m_in >= 0){ close(m_in); m_in = -1; }
+		if(m_pid > 0){
+			int status = 0;
+			bool exited = false;
+			for(int i = 0; i < 20 && !exited; ++i){
+				exited = (waitpid(m_pid, &status, WNOHANG) == m_pid);
+				if(!exited){ std::this_thread::sleep_for(std::chrono::milliseconds(10)); }
+			}
+			if(!exited){
+				kill(-m_pid, SIGKILL);
+				kill(m_pid, SIGKILL);
+				waitpid(m_pid, &status, 0);
+			}
+			m_pid = -1;
+		}
+		if(m_out >= 0){ close(m_out); m_out = -1; }
+		if(m_epoll >= 0){ close(m_epoll); m_epoll = -1; }
+		m_buffer.clear();
+	}
+
+};
+
+enum class Failure {
+	NONE,
+	TIME,      // time limit exceeded
+	ILLEGAL,   // invalid move or selection
+	CRASH      // could not be started, exited or sent garbage
+};
+
+struct GameResult {
+	int black = 0;               // engine playing black
+	int stones[2] = { 0, 0 };    // by engine
+	int winner = -1;             // engine index, -1 for a draw
+	Failure failure = Failure::NONE;
+	double time_used[2] = { 0.0, 0.0 };
+	double max_move_time[2] = { 0.0, 0.0 };
+	int num_responses[2] = { 0, 0 };
+};
+
+// reads `n` integers following "key" in a JSON response
+static bool parse_ints(const std::string& line, const char *key, int *values, int n){
+	const std::string quoted = std::string("\"") + key + "\"";
+	auto pos = line.find(quoted);
+	if(pos == std::string::npos){ return false; }
+	const char *p = line.c_str() + pos + quoted.size();
+	for(int i = 0; i < n; ++i){
+		while(*p && (*p < '0' || *p > '9') && *p != '-'){ ++p; }
+		if(!*p){ return false; }
+		char *end;
+		values[i] = static_cast<int>(strtol(p, &end, 10));
+		p = end;
+	}
+	return true;
+}
+
+class Arena {
+
+private:
+	typedef std::chrono::steady_clock clock_type;
+
+	ArenaOptions m_options;
+	std::string m_names[2];
+	std::string m_commands[2];
+	std::mutex m_mutex;
+	std::atomic<int> m_next_game;
+	std::atomic<bool> m_stopped;
+	std::vector<GameResult> m_results;
+	std::vector<Opening> m_openings;
+	// games of unfinished pairs by pair index
+	std::map<int, GameResult> m_half_pairs;
+	SPRT m_sprt;
+
+	// both games of pair (game / 2) start from the same opening
+	Opening opening(int game) const {
+		const int pair = game / 2;
+		if(!m_openings.empty()){ return m_openings[pair % m_openings.size()]; }
+		if(m_options.random_plies > 0){
+			return random_opening(m_options.random_plies, m_options.seed * 1000003u + pair);
+		}
+		return Opening();
+	}
+
+	static double score(const GameResult& result, int engine){
+		return result.winner == engine ? 1.0 : result.winner < 0 ? 0.5 : 0.0;
+	}
+
+	static std::string board_json(const GameTracker& tracker){
+		const auto& board = tracker.state().classic_board();
+		uint64_t quantum = 0;
+		for(const auto& e : tracker.state().edges()){
+			quantum |= (1ul << e.u) | (1ul << e.v);
+		}
+		if(tracker.has_pending()){
+			const auto pending = tracker.pending_move();
+			quantum |= (1ul << pending.first) | (1ul << pending.second);
+		}
+		std::string s = "[";
+		for(int i = 0; i < 36; ++i){
+			if(i > 0){ s += ", "; }
+			const int c = board.get(i);
+			s += (c > 0 ? "\"o\"" : c < 0 ? "\"x\"" : (quantum >> i) & 1 ? "\"=\"" : "\"_\"");
+		}
+		return s + "]";
+	}
+
+	static std::string moves_json(const GameTracker& tracker){
+		std::ostringstream oss;
+		oss << "[";
+		const auto& history = tracker.history();
+		for(size_t i = 0; i < history.size(); ++i){
+			const auto& h = history[i];
+			if(i > 0){ oss << ", "; }
+			oss << "[[" << h.p << ", " << h.q << "], " << h.select << "]";
+		}
+		oss << "]";
+		return oss.str();
+	}
+
+	// one request/response exchange with player `idx` of a game, charging
+	// the elapsed time to its clock like the referee does
+	struct Player {
+		EngineProcess process;
+		int engine = 0;
+		bool binary = false;
+		double remaining = 0.0;
+		GameResult *result = nullptr;
+
+		bool exchange(const std::string& json, const RequestFrame& frame, std::string& line, ResponseFrame& response){
+			const auto start = clock_type::now();
+			const auto deadline = start + std::chrono::duration_cast<clock_type::duration>(
+				std::chrono::duration<double>(std::max(remaining, 0.0)));
+			bool ok;
+			if(binary){
+				ok = process.write_all(&frame, sizeof(frame)) &&
+				     process.read_bytes(&response, sizeof(response), deadline);
+			}else{
+				ok = process.write_line(json) && process.read_line(line, deadline);
+			}
+			const double elapsed =
+				std::chrono::duration<double>(clock_type::now() - start).count();
+			remaining -= elapsed;
+			result->time_used[engine] += elapsed;
+			result->max_move_time[engine] = std::max(result->max_move_time[engine], elapsed);
+			++result->num_responses[engine];
+			return ok;
+		}
+	};
+
+	static void lose(GameResult& result, const Player& player, Failure failure){
+		result.winner = player.engine ^ 1;
+		result.failure = failure;
+	}
+
+	static Failure classify(const Player& player){
+		return player.remaining <= 0.0 ? Failure::TIME : Failure::CRASH;
+	}
+
+	void quit(Player *players){
+		for(int i = 0; i < 2; ++i){
+			auto& player = players[i];
+			const auto deadline = clock_type::now() + std::chrono::milliseconds(
+				static_cast<int>(1000.0 * std::min(std::max(player.remaining, 0.0), 1.0)));
+			std::string line;
+			ResponseFrame response;
+			if(player.binary){
+				const auto frame = encode_request(Action::QUIT, State(), std::vector<History>());
+				if(player.process.write_all(&frame, sizeof(frame))){
+					player.process.read_bytes(&response, sizeof(response), deadline);
+				}
+			}else if(player.process.write_line("{\"action\": \"quit\"}")){
+				player.process.read_line(line, deadline);
+			}
+			player.process.stop();
+		}
+	}
+
+	GameResult play_game(int game){
+		GameResult result;
+		result.black = (game & 1);
+		Player players[2];
+		for(int i = 0; i < 2; ++i){
+			players[i].engine = result.black ^ i;
+			players[i].remaining = m_options.time_limit;
+			players[i].result = &result;
+		}
+		GameTracker tracker;
+		for(const auto& m : opening(game)){ tracker.play(m.first, m.second); }
+		std::string line;
+		ResponseFrame response;
+		const RequestFrame no_frame = RequestFrame();
+
+		for(int i = 0; i < 2; ++i){
+			auto& player = players[i];
+			if(!player.process.start(m_commands[player.engine], m_options.verbose)){
+				lose(result, player, Failure::CRASH);
+				quit(players);
+				return result;
+			}
+		}
+		for(int i = 0; i < 2; ++i){
+			auto& player = players[i];
+			std::ostringstream oss;
+			oss << "{\"action\": \"init\", \"index\": " << i
+			    << ", \"names\": [\"" << m_names[players[0].engine] << "\", \""
+			    << m_names[players[1].engine] << "\"], \"size\": [6, 6], \"board\": "
+			    << board_json(tracker) << ", \"moves\": " << moves_json(tracker)
+			    << ", \"black\": \"o\", \"white\": \"x\", \"quantum\": \"=\", \"empty\": \"_\"";
+			if(m_options.binary){ oss << ", \"protocol\": \"binary\""; }
+			oss << "}";
+			if(!player.exchange(oss.str(), no_frame, line, response) || player.remaining <= 0.0){
+				lose(result, player, classify(player));
+				quit(players);
+				return result;
+			}
+			player.binary = m_options.binary && line.find("\"binary\"") != std::string::npos;
+		}
+
+		int idx = tracker.step() & 1;
+		while(true){
+			const auto& board = tracker.state().classic_board();
+			if(board.count(1) + board.count(-1) >= 36){ break; }
+			{	// play
+				auto& player = players[idx];
+				const auto json = "{\"action\": \"play\", \"board\": " + board_json(tracker) +
+				                  ", \"moves\": " + moves_json(tracker) + "}";
+				const auto frame = player.binary
+					? encode_request(Action::PLAY, tracker.state(), tracker.history())
+					: no_frame;
+				if(!player.exchange(json, frame, line, response) || player.remaining <= 0.0){
+					lose(result, player, classify(player));
+					break;
+				}
+				int pos[2];
+				if(player.binary){
+					pos[0] = response.p;
+					pos[1] = response.q;
+				}else if(!parse_ints(line, "positions", pos, 2)){
+					lose(result, player, Failure::CRASH);
+					break;
+				}
+				if(pos[0] < 0 || pos[0] >= 36 || pos[1] < 0 || pos[1] >= 36 ||
+				   !tracker.play(pos[0], pos[1]))
+				{
+					lose(result, player, Failure::ILLEGAL);
+					break;
+				}
+			}
+			idx ^= 1;
+			if(tracker.has_pending()){
+				auto& player = players[idx];
+				const auto pending = tracker.pending_move();
+				std::ostringstream oss;
+				oss << "{\"action\": \"select\", \"entanglement\": [" << pending.first << ", "
+				    << pending.second << "], \"board\": " << board_json(tracker)
+				    << ", \"moves\": " << moves_json(tracker) << "}";
+				const auto frame = player.binary
+					? encode_request(Action::SELECT, tracker.state(), tracker.history(),
+					                 pending.first, pending.second)
+					: no_frame;
+				if(!player.exchange(oss.str(), frame, line, response) || player.remaining <= 0.0){
+					lose(result, player, classify(player));
+					break;
+				}
+				int cell = response.select;
+				if(!player.binary && !parse_ints(line, "select", &cell, 1)){
+					lose(result, player, Failure::CRASH);
+					break;
+				}
+				if(!tracker.select(cell)){
+					lose(result, player, Failure::ILLEGAL);
+					break;
+				}
+			}
+		}
+		quit(players);
+		if(result.failure == Failure::NONE){
+			const auto& board = tracker.state().classic_board();
+			result.stones[result.black] = board.count(1);
+			result.stones[result.black ^ 1] = board.count(-1);
+			const int diff = result.stones[0] - result.stones[1];
+			result.winner = (diff > 0 ? 0 : diff < 0 ? 1 : -1);
+		}
+		return result;
+	}
+
+	void report_game(int game, const GameResult& result){
+		const int done = static_cast<int>(m_results.size());
+		std::cout << "[" << std::setw(5) << done << "/" << m_options.num_games << "] game "
+		          << game << ": " << m_names[result.black] << " (black) vs "
+		          << m_names[result.black ^ 1] << ": ";
+		if(result.failure != Failure::NONE){
+			static const char *reasons[] = { "", "time limit exceeded", "invalid move", "crashed" };
+			std::cout << m_names[result.winner ^ 1] << " "
+			          << reasons[static_cast<int>(result.failure)];
+		}else{
+			std::cout << result.stones[result.black] << " - " << result.stones[result.black ^ 1];
+		}
+		std::cout << std::endl;
+	}
+
+	void worker(){
+		while(!m_stopped){
+			const int game = m_next_game++;
+			if(game >= m_options.num_games){ break; }
+			const auto result = play_game(game);
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_results.push_back(result);
+			report_game(game, result);
+			const auto it = m_half_pairs.find(game / 2);
+			if(it == m_half_pairs.end()){
+				m_half_pairs.emplace(game / 2, result);
+				continue;
+			}
+			m_sprt.add_pair(score(it->second, 0) + score(result, 0));
+			m_half_pairs.erase(it);
+			if(m_options.sprt){
+				report_sprt();
+				if(m_sprt.status() != SPRT::Result::CONTINUE){ m_stopped = true; }
+			}
+		}
+	}
+
+	void report_sprt() const {
+		double elo, error;
+		m_sprt.elo(elo, error);
+		std::cout << std::fixed << std::setprecision(2) << "    SPRT: LLR " << m_sprt.llr()
+		          << " [" << m_sprt.lower_bound() << ", " << m_sprt.upper_bound() << "], "
+		          << m_sprt.num_pairs() << " pairs, Elo " << elo << " +/- " << error
+		          << std::defaultfloat << std::endl;
+	}
+
+	void summarize(double wall_time) const {
+		std::cout << std::fixed << std::setprecision(3);
+		std::cout << "### " << m_results.size() << " games in " << wall_time << " s" << std::endl;
+		if(m_sprt.num_pairs() > 0){
+			double elo, error;
+			m_sprt.elo(elo, error);
+			const auto& penta = m_sprt.pentanomial();
+			std::cout << "### " << m_names[0] << " vs " << m_names[1] << ": Elo " << elo
+			          << " +/- " << error << " (95%), pairs " << penta[0] << "/" << penta[1]
+			          << "/" << penta[2] << "/" << penta[3] << "/" << penta[4] << std::endl;
+		}
+		if(m_options.sprt){
+			const auto status = m_sprt.status();
+			std::cout << "### SPRT(" << m_options.elo0 << ", " << m_options.elo1 << "): LLR "
+			          << m_sprt.llr() << " [" << m_sprt.lower_bound() << ", "
+			          << m_sprt.upper_bound() << "], "
+			          << (status == SPRT::Result::H1 ? "H1 accepted" :
+			              status == SPRT::Result::H0 ? "H0 accepted" : "inconclusive")
+			          << std::endl;
+		}
+		for(int e = 0; e < 2; ++e){
+			int wins[2] = { 0, 0 }, draws[2] = { 0, 0 }, losses[2] = { 0, 0 };
+			int failures[4] = { 0, 0, 0, 0 };
+			double time_used = 0.0, max_game_time = 0.0, max_move_time = 0.0;
+			int num_responses = 0;
+			for(const auto& r : m_results){
+				const int color = (r.black == e ? 0 : 1);
+				if(r.winner == e){
+					++wins[color];
+				}else if(r.winner < 0){
+					++draws[color];
+				}else{
+					++losses[color];
+					++failures[static_cast<int>(r.failure)];
+				}
+				time_used += r.time_used[e];
+				max_game_time = std::max(max_game_time, r.time_used[e]);
+				max_move_time = std::max(max_move_time, r.max_move_time[e]);
+				num_responses += r.num_responses[e];
+			}
+			const int w = wins[0] + wins[1], d = draws[0] + draws[1], l = losses[0] + losses[1];
+			const int n = std::max(1, w + d + l);
+			std::cout << "### " << m_names[e] << ": W " << w << " D " << d << " L " << l
+			          << " (" << 100.0 * (w + 0.5 * d) / n << "%)"
+			          << ", black W/D/L " << wins[0] << "/" << draws[0] << "/" << losses[0]
+			          << ", white W/D/L " << wins[1] << "/" << draws[1] << "/" << losses[1]
+			          << std::endl;
+			std::cout << "###   time: " << time_used / n << " s/game (max " << max_game_time
+			          << "), " << time_used / std::max(1, num_responses) << " s/response (max "
+			          << max_move_time << "), losses by time " << failures[1]
+			          << ", invalid " << failures[2] << ", crash " << failures[3] << std::endl;
+		}
+	}
+
+public:
+	Arena(const ArenaOptions& options, const std::string *names, const std::string *commands)
+		: m_options(options)
+		, m_mutex()
+		, m_next_game(0)
+		, m_stopped(false)
+		, m_results()
+		, m_openings()
+		, m_half_pairs()
+		, m_sprt(options.elo0, options.elo1, options.alpha, options.beta)
+	{
+		for(int i = 0; i < 2; ++i){
+			m_names[i] = names[i];
+			m_commands[i] = commands[i];
+		}
+	}
+
+	bool load_openings(){
+		if(!m_options.openings){ return true; }
+		return ::load_openings(m_options.openings, m_openings);
+	}
+
+	void run(){
+		const auto start = clock_type::now();
+		std::vector<std::thread> threads;
+		const int num_threads = std::max(1, std::min(m_options.num_threads, m_options.num_games));
+		for(int i = 0; i < num_threads; ++i){
+			threads.emplace_back([this]{ worker(); });
+		}
+		for(auto& t : threads){ t.join(); }
+		summarize(std::chrono::duration<double>(clock_type::now() - start).count());
+	}
+
+};
+
+static void usage(const char *name){
+	std::cerr << "Usage: " << name << " [options] name1 command1 name2 command2" << std::endl;
+	std::cerr << "  -n games   : number of games, colors alternate (default: 100)" << std::endl;
+	std::cerr << "  -j games   : games played at the same time (default: all cores)" << std::endl;
+	std::cerr << "  -t seconds : time limit per player and game (default: 1000)" << std::endl;
+	std::cerr << "  -b         : offer the binary protocol to the engines" << std::endl;
+	std::cerr << "  -v         : show the engines' stderr" << std::endl;
+	std::cerr << "  -o path    : openings, one line of \"p,q\" pairs each (default: none)" << std::endl;
+	std::cerr << "  -r plies   : random openings of this length without -o, at most 31" << std::endl;
+	std::cerr << "               (default: 0)" << std::endl;
+	std::cerr << "  -s seed    : seed of the random openings (default: 1)" << std::endl;
+	std::cerr << "  -S e0,e1   : SPRT of H0 elo <= e0 against H1 elo >= e1, -n is the maximum" << std::endl;
+	std::cerr << "  -e a,b     : SPRT error rates alpha and beta (default: 0.05,0.05)" << std::endl;
+}
+
+static bool parse_pair(const char *s, double& a, double& b){
+	return sscanf(s, "%lf,%lf", &a, &b) == 2;
+}
+
+int main(int argc, char *argv[]){
+	signal(SIGPIPE, SIG_IGN);
+	ArenaOptions options;
+	std::vector<std::string> args;
+	for(int i = 1; i < argc; ++i){
+		if(strcmp(argv[i], "-b") == 0){
+			options.binary = true;
+		}else if(strcmp(argv[i], "-v") == 0){
+			options.verbose = true;
+		}else if(argv[i][0] == '-' && argv[i][1] != '\0' && argv[i][2] == '\0'){
+			if(i + 1 >= argc){ usage(argv[0]); return 1; }
+			if(strcmp(argv[i], "-n") == 0){
+				options.num_games = atoi(argv[++i]);
+			}else if(strcmp(argv[i], "-j") == 0){
+				options.num_threads = atoi(argv[++i]);
+			}else if(strcmp(argv[i], "-t") == 0){
+				options.time_limit = atof(argv[++i]);
+			}else if(strcmp(argv[i], "-o") == 0){
+				options.openings = argv[++i];
+			}else if(strcmp(argv[i], "-r") == 0){
+				options.random_plies = atoi(argv[++i]);
+				if(options.random_plies < 0 || options.random_plies > MAX_RANDOM_PLIES){
+					std::cerr << "-r must be in [0, " << MAX_RANDOM_PLIES << "]" << std::endl;
+					return 1;
+				}
+			}else if(strcmp(argv[i], "-s") == 0){
+				options.seed = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+			}else if(strcmp(argv[i], "-S") == 0){
+				options.sprt = parse_pair(argv[++i], options.elo0, options.elo1);
+				if(!options.sprt){ usage(argv[0]); return 1; }
+			}else if(strcmp(argv[i], "-e") == 0){
+				if(!parse_pair(argv[++i], options.alpha, options.beta)){ usage(argv[0]); return 1; }
+			}else{
+				usage(argv[0]);
+				return 1;
+			}
+		}else{
+			args.push_back(argv[i]);
+		}
+	}
+	if(args.size() != 4){
+		usage(argv[0]);
+		return 1;
+	}
+	const std::string names[2] = { args[0], args[2] };
+	const std::string commands[2] = { args[1], args[3] };
+	Arena arena(options, names, commands);
+	if(!arena.load_openings()){
+		std::cerr << "failed to load openings: " << options.openings << std::endl;
+		return 1;
+	}
+	arena.run();
+	return 0;
+}
@@ -0,0 +1,279 @@
+// Microbenchmarks of the board, state and search hot paths
+// g++ src/benchmark.cpp -std=c++14 -O3 -mavx2 -o benchmark
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <cstdlib>
+#include <cstring>
+#include "state.hpp"
+#include "random.hpp"
+#include "playout.hpp"
+#include "rollout_policy.hpp"
+#include "mcts.hpp"
+#include "game_tracker.hpp"
+#include "ntuple.hpp"
+#include "quantum_features.hpp"
+#include "network.hpp"
+
+struct BenchmarkOptions {
+	double seconds = 0.5;       // measuring time per benchmark
+	uint32_t seed = 1;
+	const char *filter = "";    // runs the benchmarks whose name contains it
+	const char *network = nullptr;  // weights for network_evaluate
+};
+
+struct BenchmarkResult {
+	std::string name;
+	long long iterations;
+	double ns_per_op;
+};
+
+// Inputs sampled from random games with a fixed seed
+struct BenchmarkInputs {
+	struct PutInput {
+		ClassicBoard board;
+		int cell, color;
+	};
+	struct PairInput {
+		State state;
+		int p, q;
+	};
+	struct SelectInput {
+		State state;
+		int cell, color;
+	};
+
+	std::vector<PutInput> puts;
+	std::vector<PairInput> pairs;
+	std::vector<SelectInput> selects;
+	std::vector<State> openings;     // step 8
+	std::vector<State> middles;      // step 20
+	std::vector<State> endings;      // step 30
+
+	static int random_cell(uint64_t free){
+		const int n = __builtin_popcountll(free);
+		int k = modulus_random(n);
+		for(; k > 0; --k){ free &= free - 1; }
+		return __builtin_ctzll(free);
+	}
+
+	void sample_game(){
+		GameTracker tracker;
+		while(true){
+			const auto& state = tracker.state();
+			const auto& board = state.classic_board();
+			const uint64_t free =
+				((1ul << 36) - 1ul) & ~(board.bitmap(1) | board.bitmap(-1));
+			if(free == 0){ break; }
+			const int step = tracker.step();
+			if(step == 8){ openings.push_back(state); }
+			if(step == 20){ middles.push_back(state); }
+			if(step == 30){ endings.push_back(state); }
+			const int color = 1 - 2 * (step & 1);
+			const int p = random_cell(free);
+			puts.push_back(PutInput{ board, p, color });
+			if(__builtin_popcountll(free) == 1){
+				tracker.play(p, p);
+				tracker.select(p);
+				continue;
+			}
+			const int q = random_cell(free & ~(1ul << p));
+			pairs.push_back(PairInput{ state, std::min(p, q), std::max(p, q) });
+			tracker.play(p, q);
+			if(tracker.has_pending()){
+				const int cell = modulus_random(2) ? p : q;
+				selects.push_back(SelectInput{ tracker.state(), cell, color });
+				tracker.select(cell);
+			}
+		}
+	}
+
+	explicit BenchmarkInputs(uint32_t seed){
+		set_seed(seed);
+		while(selects.size() < 1024 || middles.size() < 64 || endings.size() < 64){
+			sample_game();
+		}
+	}
+};
+
+class BenchmarkRunner {
+
+private:
+	typedef std::chrono::steady_clock clock_type;
+
+	BenchmarkOptions m_options;
+	std::vector<BenchmarkResult> m_results;
+
+public:
+	explicit BenchmarkRunner(const BenchmarkOptions& options)
+		: m_options(options)
+		, m_results()
+	{ }
+
+	// `body(i)` runs the i-th operation; the batch size doubles until the
+	// measuring time is reached
+	void run(const std::string& name, const std::function<void(long long)>& body){
+		if(name.find(m_options.filter) == std::string::npos){ return; }
+		set_seed(m_options.seed);
+		for(long long i = 0; i < 16; ++i){ body(i); }  // warm-up
+		long long iterations = 0, batch = 16;
+		double elapsed = 0.0;
+		while(elapsed < m_options.seconds){
+			const auto start = clock_type::now();
+			for(long long i = 0; i < batch; ++i){ body(iterations + i); }
+			elapsed += std::chrono::duration<double>(clock_type::now() - start).count();
+			iterations += batch;
+			batch *= 2;
+		}
+		m_results.push_back(BenchmarkResult{ name, iterations, elapsed * 1e9 / iterations });
+		std::cerr << name << ": " << elapsed * 1e9 / iterations << " ns/op" << std::endl;
+	}
+
+	void write_json(std::ostream& os) const {
+		os << std::fixed << std::setprecision(3);
+		os << "{\"seed\": " << m_options.seed << ", \"benchmarks\": [";
+		for(size_t i = 0; i < m_results.size(); ++i){
+			const auto& r = m_results[i];
+			os << (i == 0 ? "" : ",") << "\n  {\"name\": \"" << r.name
+			   << "\", \"iterations\": " << r.iterations
+			   << ", \"ns_per_op\": " << r.ns_per_op
+			   << ", \"ops_per_sec\": " << 1e9 / r.ns_per_op << "}";
+		}
+		os << "\n]}" << std::endl;
+	}
+
+};
+
+// the final value of the sink of main(); the volatile store keeps every
+// result folded into it
+static volatile uint64_t g_sink = 0;
+
+static void usage(const char *name){
+	std::cerr << "Usage: " << name << " [options]" << std::endl;
+	std::cerr << "  -t seconds : measuring time per benchmark (default: 0.5)" << std::endl;
+	std::cerr << "  -s seed    : seed of the inputs and playouts (default: 1)" << std::endl;
+	std::cerr << "  -f name    : run only benchmarks whose name contains this" << std::endl;
+	std::cerr << "  -n path    : policy/value network to run network_evaluate with" << std::endl;
+}
+
+int main(int argc, char *argv[]){
+	BenchmarkOptions options;
+	for(int i = 1; i < argc; ++i){
+		if(i + 1 >= argc){ usage(argv[0]); return 1; }
+		if(strcmp(argv[i], "-t") == 0){
+			options.seconds = atof(argv[++i]);
+		}else if(strcmp(argv[i], "-s") == 0){
+			options.seed = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+		}else if(strcmp(argv[i], "-f") == 0){
+			options.filter = argv[++i];
+		}else if(strcmp(argv[i], "-n") == 0){
+			options.network = argv[++i];
+		}else{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	const BenchmarkInputs inputs(options.seed);
+	BenchmarkRunner runner(options);
+	// results are folded into `sink`, which ends in g_sink, so that no work
+	// can be optimized away
+	uint64_t sink = 0;
+
+	runner.run("classic_board_put", [&](long long i){
+		const auto& in = inputs.puts[i % inputs.puts.size()];
+		ClassicBoard b = in.board;
+		b.put(in.cell, in.color);
+		sink += b.bitmap(1);
+	});
+	runner.run("state_test_entanglement", [&](long long i){
+		const auto& in = inputs.pairs[i % inputs.pairs.size()];
+		sink += in.state.test_entanglement(in.p, in.q);
+	});
+	runner.run("state_select_entanglement", [&](long long i){
+		const auto& in = inputs.selects[i % inputs.selects.size()];
+		State s = in.state;
+		s.select_entanglement(in.cell, in.color);
+		sink += s.classic_board().bitmap(1);
+	});
+	runner.run("ntuple_indices", [&](long long i){
+		const auto& in = inputs.puts[i % inputs.puts.size()];
+		uint32_t indices[ntuple::MAX_INSTANCES];
+		ntuple::indexer().indices(in.board, indices);
+		sink += indices[0] + indices[ntuple::indexer().num_instances() - 1];
+	});
+	const std::pair<const char *, const std::vector<State> *> phases[] = {
+		std::make_pair("opening", &inputs.openings),
+		std::make_pair("middle", &inputs.middles),
+		std::make_pair("ending", &inputs.endings)
+	};
+	runner.run("quantum_features", [&](long long i){
+		const QuantumFeatures features(inputs.middles[i % inputs.middles.size()]);
+		sink += features.count(MIXED_CELLS) + features.group(i % 36);
+	});
+	network::Network net;
+	if(options.network && !net.open(options.network)){
+		std::cerr << "failed to load network: " << options.network << std::endl;
+		return 1;
+	}
+	if(net.is_open()){
+		runner.run("network_evaluate", [&](long long i){
+			network::Output out;
+			net.evaluate(inputs.middles[i % inputs.middles.size()], 1 - 2 * (i & 1), 0, out);
+			sink += static_cast<uint64_t>(out.value * 1000.0f);
+		});
+	}
+	for(const auto& phase : phases){
+		const auto& states = *phase.second;
+		runner.run(std::string("playout_") + phase.first, [&](long long i){
+			sink += playout(states[i % states.size()]);
+		});
+	}
+	// every weight of the rollout policy at the bound of the trainer, so
+	// that a few cells and components take nearly all of the mass
+	std::vector<float> saturated(rollout::NUM_WEIGHTS);
+	for(int k = 0; k < rollout::NUM_WEIGHTS; ++k){
+		saturated[k] = k & 1 ? -rollout::MAX_WEIGHT : rollout::MAX_WEIGHT;
+	}
+	rollout::Policy policy;
+	policy.set_weights(saturated);
+	for(const auto& phase : phases){
+		const auto& states = *phase.second;
+		runner.run(std::string("playout_saturated_") + phase.first, [&](long long i){
+			sink += playout(states[i % states.size()], &policy);
+		});
+	}
+	for(const auto& phase : phases){
+		const auto& states = *phase.second;
+		runner.run(std::string("mcts_expand_") + phase.first, [&](long long i){
+			const auto& s = states[i % states.size()];
+			const int color = (s.classic_board().count(1) + s.classic_board().count(-1) +
+			                   s.edges().size()) & 1 ? 1 : -1;
+			mcts::MCTSNode node(nullptr, s, color, mcts::Move(), false);
+			mcts::CancellationToken token;
+			node.expand(token);
+			sink += node.children().size();
+		});
+	}
+	{	// one update of a tree that grows from the first middle-game position
+		const auto& s = inputs.middles.front();
+		const int color = (s.classic_board().count(1) + s.classic_board().count(-1) +
+		                   s.edges().size()) & 1 ? 1 : -1;
+		std::unique_ptr<mcts::MCTSNode> root;
+		mcts::CancellationToken token;
+		runner.run("mcts_update", [&](long long i){
+			if(i == 0 || !root){
+				root.reset(new mcts::MCTSNode(nullptr, s, color, mcts::Move(), false));
+				root->expand(token);
+			}
+			sink += static_cast<uint64_t>(root->update(token)[0]);
+		});
+	}
+
+	runner.write_json(std::cout);
+	g_sink = sink;
+	return 0;
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "state.hpp"
+#include "protocol.hpp"
+
+// Optional binary protocol for mass self-play. It is negotiated by an init
+// message carrying "protocol": "binary" and a reply {"protocol":"binary"};
+// every later message in both directions is one fixed-size little-endian
+// frame starting with its length.
+
+static constexpr int BINARY_MAX_MOVES = 36;
+
+// packed move: p | q << 6 | collapsed << 12 | select << 13
+inline uint16_t pack_move(const History& h){
+	const int collapsed = (h.select >= 0);
+	const int select = (h.select > 0);
+	return static_cast<uint16_t>(h.p | (h.q << 6) | (collapsed << 12) | (select << 13));
+}
+
+inline History unpack_move(uint16_t x){
+	const int p = x & 63, q = (x >> 6) & 63;
+	const int select = (x & (1u << 12)) ? static_cast<int>((x >> 13) & 1) : -1;
+	return History(p, q, select);
+}
+
+// referee -> engine
+struct RequestFrame {
+	uint16_t length;       // sizeof(RequestFrame)
+	uint8_t action;        // Action
+	uint8_t num_moves;
+	uint8_t entanglement[2];
+	uint8_t index;         // init: own player index
+	uint8_t reserved;
+	uint64_t black;        // classic stones
+	uint64_t white;
+	uint16_t moves[BINARY_MAX_MOVES];
+};
+
+// engine -> referee
+struct ResponseFrame {
+	uint16_t length;       // sizeof(ResponseFrame)
+	uint8_t action;        // Action of the answered request
+	uint8_t p, q;          // play
+	uint8_t select;        // select
+	uint16_t reserved;
+};
+
+static_assert(sizeof(RequestFrame) == 96, "unexpected RequestFrame layout");
+static_assert(sizeof(ResponseFrame) == 8, "unexpected ResponseFrame layout");
+
+inline RequestFrame encode_request(
+	Action action, const State& board, const std::vector<History>& moves,
+	int entanglement_p = 0, int entanglement_q = 0, int index = 0)
+{
+	RequestFrame frame = RequestFrame();
+	frame.length = sizeof(RequestFrame);
+	frame.action = static_cast<uint8_t>(action);
+	frame.num_moves = static_cast<uint8_t>(moves.size());
+	frame.entanglement[0] = static_cast<uint8_t>(entanglement_p);
+	frame.entanglement[1] = static_cast<uint8_t>(entanglement_q);
+	frame.index = static_cast<uint8_t>(index);
+	frame.black = board.classic_board().bitmap(1);
+	frame.white = board.classic_board().bitmap(-1);
+	for(size_t i = 0; i < moves.size() && i < BINARY_MAX_MOVES; ++i){
+		frame.moves[i] = pack_move(moves[i]);
+	}
+	return frame;
+}
+
+inline bool decode_request(const RequestFrame& frame, Message& message){
+	if(frame.length != sizeof(RequestFrame) || frame.num_moves > BINARY_MAX_MOVES){
+		return false;
+	}
+	if(frame.action < static_cast<uint8_t>(Action::INIT) ||
+	   frame.action > static_cast<uint8_t>(Action::QUIT))
+	{
+		return false;
+	}
+	message.action = static_cast<Action>(frame.action);
+	message.index = frame.index;
+	message.board = State();
+	for(uint64_t b = frame.black & ((1ul << 36) - 1); b; b &= b - 1){
+		message.board.force_put_classic(__builtin_ctzll(b), 1);
+	}
+	for(uint64_t b = frame.white & ((1ul << 36) - 1); b; b &= b - 1){
+		message.board.force_put_classic(__builtin_ctzll(b), -1);
+	}
+	message.moves.clear();
+	for(int i = 0; i < frame.num_moves; ++i){
+		const auto h = unpack_move(frame.moves[i]);
+		if(h.p > h.q){ return false; }
+		message.moves.push_back(h);
+	}
+	message.entanglement = std::make_pair<int, int>(
+		frame.entanglement[0] % 36, frame.entanglement[1] % 36);
+	return true;
+}
+
+inline ResponseFrame make_response(Action action, int p = 0, int q = 0, int select = 0){
+	ResponseFrame frame = ResponseFrame();
+	frame.length = sizeof(ResponseFrame);
+	frame.action = static_cast<uint8_t>(action);
+	frame.p = static_cast<uint8_t>(p);
+	frame.q = static_cast<uint8_t>(q);
+	frame.select = static_cast<uint8_t>(select);
+	return frame;
+}
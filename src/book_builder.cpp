@@ -0,0 +1,161 @@
+// Offline opening book builder
+// g++ src/book_builder.cpp -std=c++14 -O3 -pthread -o book_builder
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <unordered_set>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <cstdlib>
+#include <cstring>
+#include "state.hpp"
+#include "mcts.hpp"
+#include "opening_book.hpp"
+
+struct BookPosition {
+	State state;
+	int step;
+	BookPosition() : state(), step(0) { }
+	BookPosition(const State& s, int t) : state(s), step(t) { }
+};
+
+struct BuilderOptions {
+	const char *output = "book.bin";
+	int max_step = 8;         // positions with step < max_step are searched
+	int width = 3;            // number of replies followed from each position
+	double seconds = 10.0;    // search time per position
+	int num_threads = static_cast<int>(std::thread::hardware_concurrency());
+};
+
+class BookBuilder {
+
+private:
+	BuilderOptions m_options;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::deque<BookPosition> m_queue;
+	std::unordered_set<uint64_t> m_visited;
+	int m_num_busy;
+	OpeningBookWriter m_writer;
+
+	void push(const BookPosition& pos){
+		if(m_visited.insert(book_key(pos.state)).second){
+			m_queue.push_back(pos);
+		}
+	}
+
+	void worker(uint32_t seed){
+		set_seed(seed);
+		mcts::MCTSSolver solver;
+		solver.set_root_policy(mcts::MCTSSolver::RootPolicy::UCB);
+		while(true){
+			BookPosition pos;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cond.wait(lock, [this]{ return !m_queue.empty() || m_num_busy == 0; });
+				if(m_queue.empty()){ break; }
+				pos = m_queue.front();
+				m_queue.pop_front();
+				++m_num_busy;
+			}
+			solver.analyze(
+				pos.state, pos.step,
+				mcts::TimeManager::duration_type(m_options.seconds));
+			auto stats = solver.root_statistics();
+			std::sort(
+				stats.begin(), stats.end(),
+				[](const mcts::RootStatistics& a, const mcts::RootStatistics& b){
+					return a.num_playouts > b.num_playouts;
+				});
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if(!stats.empty() && stats[0].num_playouts > 0){
+				const auto& best = stats[0];
+				const double win_rate =
+					static_cast<double>(best.num_wins) / best.num_playouts;
+				m_writer.add(
+					pos.state, best.move.p, best.move.q, win_rate, best.num_playouts);
+				std::cerr << "step " << pos.step << ": (" << best.move.p << ", "
+				          << best.move.q << ") " << win_rate << " ["
+				          << m_writer.size() << " entries, "
+				          << m_queue.size() << " queued]" << std::endl;
+			}
+			if(pos.step + 1 < m_options.max_step){
+				const int color = 1 - 2 * (pos.step & 1);
+				const int width = std::min<int>(m_options.width, stats.size());
+				for(int i = 0; i < width; ++i){
+					const auto& m = stats[i].move;
+					// positions waiting for a selection are not in the book
+					if(m.p == m.q || pos.state.test_entanglement(m.p, m.q)){ continue; }
+					State next = pos.state;
+					next.put(m.p, m.q, color);
+					push(BookPosition(next, pos.step + 1));
+				}
+			}
+			--m_num_busy;
+			m_cond.notify_all();
+		}
+	}
+
+public:
+	explicit BookBuilder(const BuilderOptions& options)
+		: m_options(options)
+		, m_mutex()
+		, m_cond()
+		, m_queue()
+		, m_visited()
+		, m_num_busy(0)
+		, m_writer()
+	{ }
+
+	bool run(){
+		push(BookPosition(State::create_initial_state(), 4));
+		std::random_device random_device;
+		std::vector<std::thread> threads;
+		for(int i = 0; i < std::max(1, m_options.num_threads); ++i){
+			const uint32_t seed = random_device();
+			threads.emplace_back([this, seed]{ worker(seed); });
+		}
+		for(auto& t : threads){ t.join(); }
+		return m_writer.write(m_options.output);
+	}
+
+};
+
+static void usage(const char *name){
+	std::cerr << "Usage: " << name << " [options]" << std::endl;
+	std::cerr << "  -o path    : output file (default: book.bin)" << std::endl;
+	std::cerr << "  -s step    : search positions before this step (default: 8)" << std::endl;
+	std::cerr << "  -w width   : replies followed from each position (default: 3)" << std::endl;
+	std::cerr << "  -t seconds : search time per position (default: 10)" << std::endl;
+	std::cerr << "  -j threads : number of worker threads (default: all cores)" << std::endl;
+}
+
+int main(int argc, char *argv[]){
+	BuilderOptions options;
+	for(int i = 1; i < argc; ++i){
+		if(i + 1 >= argc){ usage(argv[0]); return 1; }
+		if(strcmp(argv[i], "-o") == 0){
+			options.output = argv[++i];
+		}else if(strcmp(argv[i], "-s") == 0){
+			options.max_step = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "-w") == 0){
+			options.width = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "-t") == 0){
+			options.seconds = atof(argv[++i]);
+		}else if(strcmp(argv[i], "-j") == 0){
+			options.num_threads = atoi(argv[++i]);
+		}else{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	BookBuilder builder(options);
+	if(!builder.run()){
+		std::cerr << "failed to write " << options.output << std::endl;
+		return 1;
+	}
+	return 0;
+}
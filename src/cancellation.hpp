@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace mcts {
+
+// number of polls between two reads of the clock
+static constexpr uint32_t CANCELLATION_POLL_INTERVAL = 16;
+
+class CancellationToken {
+
+public:
+	using clock_type = std::chrono::steady_clock;
+
+private:
+	clock_type::time_point m_deadline;
+	std::atomic<bool> m_cancelled;
+	uint32_t m_counter;
+
+public:
+	CancellationToken()
+		: m_deadline(clock_type::time_point::max())
+		, m_cancelled(false)
+		, m_counter(0)
+	{ }
+
+	void reset(clock_type::time_point deadline){
+		m_deadline = deadline;
+		m_cancelled.store(false, std::memory_order_relaxed);
+		m_counter = 0;
+	}
+
+	// may be called from any thread
+	void cancel(){
+		m_cancelled.store(true, std::memory_order_relaxed);
+	}
+
+	// cheap query without reading the clock
+	bool cancelled() const {
+		return m_cancelled.load(std::memory_order_relaxed);
+	}
+
+	// polls the deadline once every CANCELLATION_POLL_INTERVAL calls
+	bool poll(){
+		if(cancelled()){ return true; }
+		if(++m_counter < CANCELLATION_POLL_INTERVAL){ return false; }
+		m_counter = 0;
+		if(clock_type::now() < m_deadline){ return false; }
+		cancel();
+		return true;
+	}
+
+};
+
+}
@@ -0,0 +1,333 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "state.hpp"
+#include "mcts.hpp"
+
+// Binary game records for training data. A file is a RecordFileHeader
+// followed by games appended one after another; every game is
+//
+//   GameRecordHeader
+//   moves after the 4 initial ones, 13 bits each (p | q << 6 | s << 12)
+//     packed LSB first and zero-padded to a multiple of 8 bytes
+//   num_positions PositionStats, one per searched decision
+//
+// where `s` is set when the selection after the move took q. Positions are
+// reconstructed by replaying the moves. A record is written with a single
+// append, so a file cut short by a crash only loses its last game.
+
+static constexpr uint32_t RECORD_MAGIC = 0x52475251u;  // "QRGR"
+static constexpr uint32_t RECORD_VERSION = 1;
+static constexpr int RECORD_MOVE_BITS = 13;
+static constexpr int RECORD_NUM_ENTRIES = 13;
+
+struct RecordFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t reserved[2];
+};
+
+struct GameRecordHeader {
+	uint16_t num_moves;
+	uint16_t num_positions;
+	int8_t score;          // black stones minus white stones at the end
+	uint8_t random_plies;  // leading moves played at random
+	uint16_t reserved;
+};
+
+struct VisitEntry {
+	uint8_t p, q;          // q == p for selections
+	uint16_t visits;       // share of the root playouts, scaled to [0, 65535]
+};
+
+struct PositionStats {
+	enum Kind : uint8_t {
+		PLACEMENT = 0,
+		SELECTION = 1
+	};
+
+	uint32_t num_playouts; // of the root
+	uint16_t value;        // root win rate of the player to decide, [0, 65535]
+	uint16_t num_children; // of the root, after removing symmetric moves
+	uint8_t kind;
+	uint8_t num_entries;
+	uint16_t ply;          // index of the move in the record
+	VisitEntry entries[RECORD_NUM_ENTRIES];  // most visited children first
+
+	// the root statistics of a search; children beyond the first
+	// RECORD_NUM_ENTRIES are only counted in `num_playouts`
+	static PositionStats from_search(
+		Kind kind, int ply, std::vector<mcts::RootStatistics> stats)
+	{
+		PositionStats result;
+		std::memset(&result, 0, sizeof(result));
+		std::stable_sort(
+			stats.begin(), stats.end(),
+			[](const mcts::RootStatistics& a, const mcts::RootStatistics& b){
+				return a.num_playouts > b.num_playouts;
+			});
+		double wins = 0.0;
+		long long playouts = 0;
+		for(const auto& s : stats){
+			wins += s.num_wins;
+			playouts += s.num_playouts;
+		}
+		result.num_playouts = static_cast<uint32_t>(playouts);
+		result.value = playouts > 0
+			? static_cast<uint16_t>(wins * 65535.0 / playouts + 0.5) : 32768;
+		result.num_children = static_cast<uint16_t>(stats.size());
+		result.kind = kind;
+		result.ply = static_cast<uint16_t>(ply);
+		const size_t n = std::min<size_t>(stats.size(), RECORD_NUM_ENTRIES);
+		result.num_entries = static_cast<uint8_t>(n);
+		for(size_t i = 0; i < n; ++i){
+			auto& entry = result.entries[i];
+			entry.p = static_cast<uint8_t>(stats[i].move.p);
+			entry.q = static_cast<uint8_t>(stats[i].move.q);
+			entry.visits = playouts > 0
+				? static_cast<uint16_t>(stats[i].num_playouts * 65535.0 / playouts + 0.5) : 0;
+		}
+		return result;
+	}
+};
+
+static_assert(sizeof(RecordFileHeader) == 16, "unexpected RecordFileHeader layout");
+static_assert(sizeof(GameRecordHeader) == 8, "unexpected GameRecordHeader layout");
+static_assert(sizeof(PositionStats) == 64, "unexpected PositionStats layout");
+
+inline size_t record_moves_size(int num_moves){
+	const size_t bytes = (static_cast<size_t>(num_moves) * RECORD_MOVE_BITS + 7) / 8;
+	return (bytes + 7) & ~static_cast<size_t>(7);
+}
+
+inline size_t record_size(const GameRecordHeader& header){
+	return sizeof(GameRecordHeader) + record_moves_size(header.num_moves) +
+	       sizeof(PositionStats) * header.num_positions;
+}
+
+// a game being recorded
+struct GameRecord {
+	std::vector<History> moves;   // select is 0 for p and 1 for q
+	std::vector<PositionStats> positions;
+	int score;
+	int random_plies;
+
+	GameRecord()
+		: moves()
+		, positions()
+		, score(0)
+		, random_plies(0)
+	{ }
+
+	void serialize(std::vector<uint8_t>& out) const {
+		GameRecordHeader header;
+		std::memset(&header, 0, sizeof(header));
+		header.num_moves = static_cast<uint16_t>(moves.size());
+		header.num_positions = static_cast<uint16_t>(positions.size());
+		header.score = static_cast<int8_t>(score);
+		header.random_plies = static_cast<uint8_t>(random_plies);
+		out.assign(record_size(header), 0);
+		std::memcpy(out.data(), &header, sizeof(header));
+		uint8_t *bits = out.data() + sizeof(header);
+		for(size_t i = 0; i < moves.size(); ++i){
+			const auto& h = moves[i];
+			const uint32_t packed = h.p | (h.q << 6) | ((h.select == 1) << 12);
+			const size_t offset = i * RECORD_MOVE_BITS;
+			const uint32_t shifted = packed << (offset & 7);
+			for(size_t k = offset / 8; k * 8 < offset + RECORD_MOVE_BITS; ++k){
+				bits[k] |= static_cast<uint8_t>(shifted >> (8 * (k - offset / 8)));
+			}
+		}
+		std::memcpy(
+			bits + record_moves_size(header.num_moves), positions.data(),
+			sizeof(PositionStats) * positions.size());
+	}
+};
+
+// appends games to a record file, creating it when necessary
+class GameRecordWriter {
+
+private:
+	int m_fd;
+	std::vector<uint8_t> m_buffer;
+
+public:
+	GameRecordWriter()
+		: m_fd(-1)
+		, m_buffer()
+	{ }
+
+	GameRecordWriter(const GameRecordWriter&) = delete;
+	GameRecordWriter& operator=(const GameRecordWriter&) = delete;
+
+	~GameRecordWriter(){
+		close();
+	}
+
+	bool open(const char *path){
+		close();
+		const int fd = ::open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+		if(fd < 0){ return false; }
+		struct stat st;
+		RecordFileHeader header;
+		bool ok = fstat(fd, &st) == 0;
+		if(ok && st.st_size == 0){
+			std::memset(&header, 0, sizeof(header));
+			header.magic = RECORD_MAGIC;
+			header.version = RECORD_VERSION;
+			ok = ::write(fd, &header, sizeof(header)) == sizeof(header);
+		}else if(ok){
+			ok = pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+			     header.magic == RECORD_MAGIC && header.version == RECORD_VERSION;
+		}
+		if(!ok){
+			::close(fd);
+			return false;
+		}
+		m_fd = fd;
+		return true;
+	}
+
+	void close(){
+		if(m_fd >= 0){ ::close(m_fd); }
+		m_fd = -1;
+	}
+
+	bool append(const GameRecord& record){
+		if(m_fd < 0){ return false; }
+		record.serialize(m_buffer);
+		const ssize_t n = ::write(m_fd, m_buffer.data(), m_buffer.size());
+		return n == static_cast<ssize_t>(m_buffer.size());
+	}
+
+};
+
+// one game of a mapped record file
+class GameRecordView {
+
+private:
+	const GameRecordHeader *m_header;
+
+	const uint8_t *move_bits() const {
+		return reinterpret_cast<const uint8_t *>(m_header + 1);
+	}
+
+public:
+	explicit GameRecordView(const GameRecordHeader *header)
+		: m_header(header)
+	{ }
+
+	int num_moves() const { return m_header->num_moves; }
+	int num_positions() const { return m_header->num_positions; }
+	int score() const { return m_header->score; }
+	int random_plies() const { return m_header->random_plies; }
+
+	// the i-th move after the initial ones; select is 0 for p and 1 for q
+	// and only meaningful when the move closed a cycle
+	History move(int i) const {
+		const size_t offset = static_cast<size_t>(i) * RECORD_MOVE_BITS;
+		const uint8_t *bits = move_bits();
+		uint32_t word = 0;
+		for(size_t k = offset / 8; k * 8 < offset + RECORD_MOVE_BITS; ++k){
+			word |= static_cast<uint32_t>(bits[k]) << (8 * (k - offset / 8));
+		}
+		const uint32_t packed = (word >> (offset & 7)) & ((1u << RECORD_MOVE_BITS) - 1);
+		return History(packed & 63, (packed >> 6) & 63, (packed >> 12) & 1);
+	}
+
+	const PositionStats& position(int i) const {
+		const auto stats = reinterpret_cast<const PositionStats *>(
+			move_bits() + record_moves_size(m_header->num_moves));
+		return stats[i];
+	}
+
+};
+
+// read-only view of a memory-mapped record file
+class GameRecordFile {
+
+private:
+	void *m_address;
+	size_t m_length;
+	std::vector<const GameRecordHeader *> m_games;
+	size_t m_num_positions;
+
+public:
+	GameRecordFile()
+		: m_address(nullptr)
+		, m_length(0)
+		, m_games()
+		, m_num_positions(0)
+	{ }
+
+	GameRecordFile(const GameRecordFile&) = delete;
+	GameRecordFile& operator=(const GameRecordFile&) = delete;
+
+	~GameRecordFile(){
+		close();
+	}
+
+	// a truncated last game is skipped
+	bool open(const char *path){
+		close();
+		const int fd = ::open(path, O_RDONLY);
+		if(fd < 0){ return false; }
+		struct stat st;
+		if(fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(RecordFileHeader))){
+			::close(fd);
+			return false;
+		}
+		void *address = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if(address == MAP_FAILED){ return false; }
+		const auto header = static_cast<const RecordFileHeader *>(address);
+		if(header->magic != RECORD_MAGIC || header->version != RECORD_VERSION){
+			munmap(address, st.st_size);
+			return false;
+		}
+		m_address = address;
+		m_length = st.st_size;
+		const auto base = static_cast<const uint8_t *>(address);
+		size_t offset = sizeof(RecordFileHeader);
+		while(offset + sizeof(GameRecordHeader) <= m_length){
+			const auto game = reinterpret_cast<const GameRecordHeader *>(base + offset);
+			const size_t size = record_size(*game);
+			if(offset + size > m_length){ break; }
+			m_games.push_back(game);
+			m_num_positions += game->num_positions;
+			offset += size;
+		}
+		return true;
+	}
+
+	void close(){
+		if(m_address){ munmap(m_address, m_length); }
+		m_address = nullptr;
+		m_length = 0;
+		m_games.clear();
+		m_num_positions = 0;
+	}
+
+	bool is_open() const {
+		return m_address != nullptr;
+	}
+
+	size_t size() const {
+		return m_games.size();
+	}
+
+	size_t num_positions() const {
+		return m_num_positions;
+	}
+
+	GameRecordView game(size_t i) const {
+		return GameRecordView(m_games[i]);
+	}
+
+};
@@ -0,0 +1,233 @@
+#pragma once
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <random>
+#include <chrono>
+#include "state.hpp"
+#include "mcts.hpp"
+#include "protocol.hpp"
+#include "game_tracker.hpp"
+#include "playout_stats.hpp"
+
+// engine settings given on the command line
+struct SolverOptions {
+	const char *book_path = nullptr;
+	const char *ntuple_path = nullptr;  // weights scoring truncated playouts
+	const char *network_path = nullptr; // policy/value network for PUCT
+	const char *rollout_path = nullptr; // rollout policy of the playouts
+	double value_weight = 0.0;          // share of its value in the leaf scores
+	int cutoff_plies = 0;
+	int cutoff_empty = 0;
+	bool ntuple_leaves = false;         // the n-tuple weights score the leaves
+	int batch_size = 1;                 // leaves scored together
+	bool sequential_halving = false;    // root policy of placements
+};
+
+// loads the files of `options` into `solver`; failures are reported and
+// leave the solver without them
+inline void configure_solver(mcts::MCTSSolver& solver, const SolverOptions& options){
+	if(options.book_path && !solver.load_book(options.book_path)){
+		std::cerr << "failed to load opening book: " << options.book_path << std::endl;
+	}
+	if(options.ntuple_path && !solver.load_evaluator(options.ntuple_path)){
+		std::cerr << "failed to load n-tuple weights: " << options.ntuple_path << std::endl;
+	}
+	if(options.network_path && !solver.load_network(options.network_path)){
+		std::cerr << "failed to load network: " << options.network_path << std::endl;
+	}
+	if(options.rollout_path && !solver.load_rollout_policy(options.rollout_path)){
+		std::cerr << "failed to load rollout policy: " << options.rollout_path << std::endl;
+	}
+	solver.set_value_weight(options.value_weight);
+	solver.set_playout_cutoff(options.cutoff_plies, options.cutoff_empty);
+	solver.set_leaf_evaluation(options.ntuple_leaves
+		? mcts::MCTSSolver::LeafEvaluation::NTUPLE
+		: mcts::MCTSSolver::LeafEvaluation::PLAYOUTS);
+	solver.set_batch_size(options.batch_size);
+	solver.set_root_policy(options.sequential_halving
+		? mcts::MCTSSolver::RootPolicy::SEQUENTIAL_HALVING
+		: mcts::MCTSSolver::RootPolicy::UCB);
+}
+
+// Server mode: many games multiplexed over one stdin/stdout. Every message
+// carries a "game_id" and every response repeats it. A game is created by
+// its init message and removed by its quit message; each one owns a search
+// tree and a clock, and the searches of all games share a pool of worker
+// threads. Messages of one game are handled in order, one at a time, and
+// the time they wait for a worker counts against the game's clock. A
+// further init of a running game starts it over.
+class GameServer {
+
+private:
+	typedef std::chrono::steady_clock clock_type;
+
+	struct Request {
+		Message message;
+		clock_type::time_point received;
+	};
+
+	struct Session {
+		int game_id;
+		mcts::MCTSSolver solver;
+		GameTracker tracker;
+		std::deque<Request> pending;
+		bool busy;         // queued or being handled by a worker
+		bool initialized;  // the solver was configured
+
+		explicit Session(int id)
+			: game_id(id)
+			, solver()
+			, tracker()
+			, pending()
+			, busy(false)
+			, initialized(false)
+		{ }
+	};
+
+	SolverOptions m_options;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	// a session leaves the map with its quit message and is destroyed once
+	// that has been handled
+	std::map<int, std::shared_ptr<Session>> m_sessions;
+	std::deque<std::shared_ptr<Session>> m_ready;
+	bool m_closed;
+	std::mutex m_output_mutex;
+
+	void write_line(const std::string& line){
+		std::lock_guard<std::mutex> lock(m_output_mutex);
+		std::cout << line << std::endl;
+	}
+
+	void handle(Session& session, const Request& request){
+		const Message& message = request.message;
+		std::ostringstream oss;
+		oss << "{\"game_id\":" << session.game_id;
+		if(message.action == Action::INIT){
+			if(session.initialized){
+				session.solver.new_game();
+				session.tracker = GameTracker();
+			}else{
+				configure_solver(session.solver, m_options);
+				session.initialized = true;
+			}
+		}else if(message.action == Action::PLAY || message.action == Action::SELECT){
+			auto& tracker = session.tracker;
+			if(!tracker.sync(message.moves, message.board)){
+				std::cerr << "game " << session.game_id
+				          << ": state mismatch, rebuilt from the board" << std::endl;
+			}
+			if(message.action == Action::PLAY){
+				const auto ret = session.solver.play(
+					tracker.state(), tracker.step(), tracker.history(), request.received);
+				oss << ",\"positions\":[" << ret.first << "," << ret.second << "]";
+			}else{
+				const auto& entanglement = message.entanglement;
+				const auto ret = session.solver.select(
+					tracker.state(), entanglement.first, entanglement.second,
+					tracker.step() - 1, tracker.history(), request.received);
+				oss << ",\"select\":" << ret;
+			}
+			// one write, so that the lines of the games do not mix
+			std::ostringstream telemetry;
+			telemetry << "{\"game_id\":" << session.game_id
+			          << ",\"telemetry\":" << session.solver.telemetry().to_json() << "}\n";
+			std::cerr << telemetry.str() << std::flush;
+			// the counters are shared by all games
+			stats::report(std::cerr);
+		}
+		oss << "}";
+		write_line(oss.str());
+	}
+
+	void worker(uint32_t seed){
+		set_seed(seed);
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while(true){
+			m_cond.wait(lock, [this]{ return !m_ready.empty() || m_closed; });
+			if(m_ready.empty()){ break; }
+			auto session = m_ready.front();
+			m_ready.pop_front();
+			const Request request = session->pending.front();
+			session->pending.pop_front();
+			lock.unlock();
+			handle(*session, request);
+			lock.lock();
+			if(!session->pending.empty()){
+				m_ready.push_back(session);
+				m_cond.notify_one();
+			}else{
+				session->busy = false;
+			}
+		}
+	}
+
+	void dispatch(const Message& message, clock_type::time_point received){
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_sessions.find(message.game_id);
+		if(it == m_sessions.end()){
+			if(message.action != Action::INIT){
+				std::cerr << "unknown game: " << message.game_id << std::endl;
+				return;
+			}
+			it = m_sessions.emplace(
+				message.game_id, std::make_shared<Session>(message.game_id)).first;
+		}
+		const auto session = it->second;
+		if(message.action == Action::QUIT){ m_sessions.erase(it); }
+		session->pending.push_back(Request{ message, received });
+		if(!session->busy){
+			session->busy = true;
+			m_ready.push_back(session);
+			m_cond.notify_one();
+		}
+	}
+
+public:
+	explicit GameServer(const SolverOptions& options)
+		: m_options(options)
+		, m_mutex()
+		, m_cond()
+		, m_sessions()
+		, m_ready()
+		, m_closed(false)
+		, m_output_mutex()
+	{ }
+
+	// serves until stdin is closed and every queued message is answered
+	void run(int num_threads){
+		std::random_device random_device;
+		std::vector<std::thread> threads;
+		for(int i = 0; i < std::max(1, num_threads); ++i){
+			const uint32_t seed = random_device();
+			threads.emplace_back([this, seed]{ worker(seed); });
+		}
+		// reading must not flush std::cout behind the workers' backs
+		std::cin.tie(nullptr);
+		ProtocolParser parser;
+		Message message;
+		std::string line;
+		while(std::getline(std::cin, line)){
+			if(!parser.parse(line, message)){
+				std::cerr << "malformed message: " << line << std::endl;
+				continue;
+			}
+			dispatch(message, clock_type::now());
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_closed = true;
+		}
+		m_cond.notify_all();
+		for(auto& t : threads){ t.join(); }
+	}
+
+};
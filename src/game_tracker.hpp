@@ -0,0 +1,232 @@
+#pragma once
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <functional>
+#include "state.hpp"
+
+// Game state maintained across moves. The engine feeds it the "moves" of
+// every message and only the entries not seen before are applied; a
+// referee drives it directly with play() and select().
+class GameTracker {
+
+private:
+	State m_state;
+	std::vector<History> m_history;
+	// history index of every edge of m_state, in the same order
+	std::vector<int> m_edge_moves;
+	// index of the move closing a cycle that waits for a selection
+	int m_pending;
+
+	static int move_color(int index){
+		return 1 - 2 * (index & 1);
+	}
+
+	// collapses the pending cycle with `cell` and records the cell taken by
+	// every collapsed move in its select field
+	void collapse(int cell){
+		const auto edges = m_state.edges();
+		uint64_t reachable = (1ul << cell);
+		while(true){
+			const auto before = reachable;
+			for(size_t i = 0; i < edges.size(); ++i){
+				const auto& e = edges[i];
+				const uint64_t u = (1ul << e.u), v = (1ul << e.v);
+				auto& h = m_history[m_edge_moves[i]];
+				if((reachable & u) && !(reachable & v)){
+					h.select = (h.p == e.v ? 0 : 1);
+					reachable |= v;
+				}else if((reachable & v) && !(reachable & u)){
+					h.select = (h.p == e.u ? 0 : 1);
+					reachable |= u;
+				}
+			}
+			if(reachable == before){ break; }
+		}
+		// same compaction as State::select_entanglement (which reuses `edges`)
+		size_t tail = 0;
+		for(size_t i = 0; i < edges.size(); ++i){
+			if(!(reachable & (1ul << edges[i].u))){ m_edge_moves[tail++] = m_edge_moves[i]; }
+		}
+		m_edge_moves.resize(tail);
+		auto& closer = m_history[m_pending];
+		closer.select = (closer.p == cell ? 0 : 1);
+		m_state.select_entanglement(cell, move_color(m_pending));
+		m_pending = -1;
+	}
+
+	// applies m_history[index]; false when it is not a legal move
+	bool apply(int index){
+		const auto& h = m_history[index];
+		const auto& board = m_state.classic_board();
+		if(m_pending >= 0){ return false; }
+		if(index < 4){
+			// initial stones
+			if(h.p != h.q || board.get(h.p)){ return false; }
+			m_state.force_put_classic(h.p, move_color(index));
+			return true;
+		}
+		if(h.p > h.q || board.get(h.p) || board.get(h.q)){ return false; }
+		if(h.p == h.q){
+			// the last cell closes a cycle by itself
+			if(board.count(1) + board.count(-1) != 35){ return false; }
+			m_pending = index;
+		}else if(m_state.test_entanglement(h.p, h.q)){
+			m_pending = index;
+		}else{
+			m_state.put(h.p, h.q, move_color(index));
+			m_edge_moves.push_back(index);
+			return true;
+		}
+		if(h.select >= 0){ collapse(h.select == 0 ? h.p : h.q); }
+		return true;
+	}
+
+	void reset_empty(){
+		m_state = State();
+		m_history.clear();
+		m_edge_moves.clear();
+		m_pending = -1;
+	}
+
+public:
+	GameTracker()
+		: m_state()
+		, m_history()
+		, m_edge_moves()
+		, m_pending(-1)
+	{
+		m_history.reserve(64);
+		m_edge_moves.reserve(36);
+		reset();
+	}
+
+	// the initial position after the 4 fixed moves
+	void reset(){
+		reset_empty();
+		const int initial[4] = { 15, 14, 20, 21 };
+		for(int i = 0; i < 4; ++i){
+			m_history.emplace_back(initial[i], initial[i], 0);
+			apply(i);
+		}
+	}
+
+	// the position before the pending move while a selection is awaited
+	const State& state() const {
+		return m_state;
+	}
+
+	const std::vector<History>& history() const {
+		return m_history;
+	}
+
+	int step() const {
+		return static_cast<int>(m_history.size());
+	}
+
+	bool has_pending() const {
+		return m_pending >= 0;
+	}
+
+	std::pair<int, int> pending_move() const {
+		const auto& h = m_history[m_pending];
+		return std::make_pair(h.p, h.q);
+	}
+
+	// history indices of the moves collapsed by the pending selection in
+	// decreasing order, so the pending move comes first
+	std::vector<int> pending_component() const {
+		std::vector<int> result;
+		if(m_pending < 0){ return result; }
+		const auto edges = m_state.edges();
+		const auto& h = m_history[m_pending];
+		uint64_t reachable = (1ul << h.p) | (1ul << h.q);
+		while(true){
+			const auto before = reachable;
+			for(const auto& e : edges){
+				if(reachable & ((1ul << e.u) | (1ul << e.v))){
+					reachable |= (1ul << e.u) | (1ul << e.v);
+				}
+			}
+			if(reachable == before){ break; }
+		}
+		result.push_back(m_pending);
+		for(size_t i = 0; i < edges.size(); ++i){
+			if(reachable & (1ul << edges[i].u)){ result.push_back(m_edge_moves[i]); }
+		}
+		std::sort(result.begin() + 1, result.end(), std::greater<int>());
+		return result;
+	}
+
+	// replays a whole move list from scratch; false at the first illegal move
+	bool rebuild(const std::vector<History>& moves){
+		reset_empty();
+		for(const auto& h : moves){
+			m_history.push_back(h);
+			if(!apply(static_cast<int>(m_history.size()) - 1)){ return false; }
+		}
+		return true;
+	}
+
+	// plays the next move; true when it is legal
+	bool play(int p, int q){
+		if(p > q){ std::swap(p, q); }
+		m_history.emplace_back(p, q, -1);
+		if(!apply(step() - 1)){
+			m_history.pop_back();
+			return false;
+		}
+		return true;
+	}
+
+	// resolves the pending cycle; true when `cell` is one of its cells
+	bool select(int cell){
+		if(m_pending < 0){ return false; }
+		const auto& h = m_history[m_pending];
+		if(cell != h.p && cell != h.q){ return false; }
+		collapse(cell);
+		return true;
+	}
+
+	// Brings the tracker to the position given by the moves of a message,
+	// applying only the entries it has not seen yet. The result is checked
+	// against the classic stones of `board` and rebuilt from scratch on a
+	// mismatch; if that does not help either, the stones of `board` and the
+	// uncollapsed moves are trusted and false is returned.
+	bool sync(const std::vector<History>& moves, const State& board){
+		bool ok = moves.size() >= m_history.size();
+		for(size_t i = 0; ok && i < m_history.size(); ++i){
+			ok = (moves[i].p == m_history[i].p && moves[i].q == m_history[i].q);
+		}
+		if(ok && m_pending >= 0 && moves[m_pending].select >= 0){
+			const auto& h = moves[m_pending];
+			collapse(h.select == 0 ? h.p : h.q);
+		}
+		for(size_t i = m_history.size(); ok && i < moves.size(); ++i){
+			m_history.push_back(moves[i]);
+			ok = apply(static_cast<int>(i));
+		}
+		if(ok && m_state.classic_board() == board.classic_board()){ return true; }
+		if(rebuild(moves) && m_state.classic_board() == board.classic_board()){
+			return true;
+		}
+		// fallback: trust the referee's board
+		reset_empty();
+		m_state = board;
+		for(size_t i = 0; i < moves.size(); ++i){
+			const auto& h = moves[i];
+			m_history.push_back(h);
+			if(i < 4 || h.select >= 0){ continue; }
+			const auto& b = m_state.classic_board();
+			if(b.get(h.p) || b.get(h.q)){ continue; }
+			if(h.p == h.q || m_state.test_entanglement(h.p, h.q)){
+				m_pending = static_cast<int>(i);
+				break;
+			}
+			m_state.put(h.p, h.q, move_color(static_cast<int>(i)));
+			m_edge_moves.push_back(static_cast<int>(i));
+		}
+		return false;
+	}
+
+};
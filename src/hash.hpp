@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdint>
+#include "state.hpp"
+
+inline uint64_t mix64(uint64_t x){
+	// splitmix64 finalizer
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ul;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebul;
+	return x ^ (x >> 31);
+}
+
+// the order of edges is part of the position since it decides the order of
+// puts when they collapse
+inline uint64_t hash_state(const State& s){
+	const auto& board = s.classic_board();
+	uint64_t h = mix64(board.bitmap(1)) ^ mix64(board.bitmap(-1) ^ 0x9e3779b97f4a7c15ul);
+	for(const auto& e : s.edges()){
+		const uint64_t packed = e.u | (e.v << 6) | ((e.color > 0) << 12);
+		h = mix64(h ^ packed);
+	}
+	return h;
+}
@@ -0,0 +1,163 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include "state.hpp"
+#include "playout.hpp"
+#include "ntuple.hpp"
+#include "network.hpp"
+
+// Scoring of the leaves of a search. A search hands its leaves to one
+// LeafEvaluator, one at a time or in batches of up to MAX_LEAF_BATCH, and
+// every backend (playouts, the n-tuple evaluator, the value of the network)
+// sits behind the same interface.
+
+namespace mcts {
+
+static constexpr int MAX_LEAF_BATCH = network::MAX_BATCH;
+
+// a position waiting for its score
+struct Leaf {
+	const State *state;
+	int color;          // player to decide
+	uint64_t pending;   // cells of a cycle waiting for a selection
+};
+
+// shares of white wins, draws and black wins, indexed by outcome + 1; they
+// add up to 1
+typedef std::array<double, 3> LeafScore;
+
+inline LeafScore black_win_share(double black){
+	LeafScore score = { 1.0 - black, 0.0, black };
+	return score;
+}
+
+// Scores non-terminal leaves. evaluate() may be called from several
+// threads at once.
+class LeafEvaluator {
+
+public:
+	virtual ~LeafEvaluator(){ }
+
+	// scores `n` <= MAX_LEAF_BATCH leaves
+	virtual void evaluate(const Leaf *leaves, int n, LeafScore *out) const = 0;
+
+};
+
+// the outcomes of `num_playouts` random playouts, truncated by `cutoff`
+// when it is enabled and drawing their moves from `policy` when it is
+// loaded
+class PlayoutLeafEvaluator : public LeafEvaluator {
+
+private:
+	PlayoutCutoff m_cutoff;
+	int m_num_playouts;
+	const rollout::Policy *m_policy;
+
+public:
+	PlayoutLeafEvaluator(
+		const PlayoutCutoff& cutoff, int num_playouts, const rollout::Policy *policy = nullptr)
+		: m_cutoff(cutoff)
+		, m_num_playouts(num_playouts)
+		, m_policy(policy)
+	{ }
+
+	void evaluate(const Leaf *leaves, int n, LeafScore *out) const override {
+		const double share = 1.0 / m_num_playouts;
+		const bool truncated = m_cutoff.enabled();
+		for(int i = 0; i < n; ++i){
+			LeafScore score = { 0.0, 0.0, 0.0 };
+			for(int k = 0; k < m_num_playouts; ++k){
+				if(truncated){
+					const double p = truncated_playout(*leaves[i].state, m_cutoff, m_policy);
+					score[2] += share * p;
+					score[0] += share * (1.0 - p);
+				}else{
+					score[playout(*leaves[i].state, m_policy) + 1] += share;
+				}
+			}
+			out[i] = score;
+		}
+	}
+
+};
+
+// the static evaluation of the n-tuple patterns
+class NTupleLeafEvaluator : public LeafEvaluator {
+
+private:
+	const ntuple::Evaluator& m_evaluator;
+
+public:
+	explicit NTupleLeafEvaluator(const ntuple::Evaluator& evaluator)
+		: m_evaluator(evaluator)
+	{ }
+
+	void evaluate(const Leaf *leaves, int n, LeafScore *out) const override {
+		for(int i = 0; i < n; ++i){
+			out[i] = black_win_share(m_evaluator.win_probability(*leaves[i].state, 1));
+		}
+	}
+
+};
+
+// the value output of the network, evaluated for the whole batch at once
+class NetworkLeafEvaluator : public LeafEvaluator {
+
+private:
+	const network::Network& m_network;
+
+public:
+	explicit NetworkLeafEvaluator(const network::Network& network)
+		: m_network(network)
+	{ }
+
+	void evaluate(const Leaf *leaves, int n, LeafScore *out) const override {
+		if(n <= 0){ return; }
+		uint16_t active[MAX_LEAF_BATCH][network::MAX_ACTIVE];
+		const uint16_t *inputs[MAX_LEAF_BATCH];
+		int num_active[MAX_LEAF_BATCH];
+		for(int i = 0; i < n; ++i){
+			num_active[i] = network::active_inputs(
+				*leaves[i].state, leaves[i].color, leaves[i].pending, active[i]);
+			inputs[i] = active[i];
+		}
+		float values[MAX_LEAF_BATCH];
+		m_network.evaluate_values(inputs, num_active, n, values);
+		for(int i = 0; i < n; ++i){
+			out[i] = black_win_share(leaves[i].color > 0 ? values[i] : 1.0 - values[i]);
+		}
+	}
+
+};
+
+// `weight` times the score of `first` plus the rest times that of `second`
+class MixedLeafEvaluator : public LeafEvaluator {
+
+private:
+	const LeafEvaluator& m_first;
+	const LeafEvaluator& m_second;
+	double m_weight;
+
+public:
+	MixedLeafEvaluator(const LeafEvaluator& first, const LeafEvaluator& second, double weight)
+		: m_first(first)
+		, m_second(second)
+		, m_weight(weight)
+	{ }
+
+	void evaluate(const Leaf *leaves, int n, LeafScore *out) const override {
+		LeafScore second[MAX_LEAF_BATCH];
+		m_first.evaluate(leaves, n, out);
+		m_second.evaluate(leaves, n, second);
+		for(int i = 0; i < n; ++i){
+			for(int k = 0; k < 3; ++k){
+				out[i][k] = m_weight * out[i][k] + (1.0 - m_weight) * second[i][k];
+			}
+		}
+	}
+
+};
+
+}
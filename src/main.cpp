@@ -2,101 +2,134 @@
 #include <utility>
 #include <random>
 #include <cassert>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
 #include "state.hpp"
 #include "mcts.hpp"
-#include "json.hpp"
+#include "protocol.hpp"
+#include "game_tracker.hpp"
+#include "binary_protocol.hpp"
+#include "game_server.hpp"
+#include "playout_stats.hpp"
 
 static std::random_device g_random_device;
 
-static State parse_state(const nlohmann::json& obj){
-	State state;
-	const auto& board = obj["board"];
-	for(int i = 0; i < 36; ++i){
-		const std::string c = board[i];
-		if(c == "o"){
-			state.force_put_classic(i, 1);
-		}else if(c == "x"){
-			state.force_put_classic(i, -1);
+static bool read_message(
+	bool binary, ProtocolParser& parser, std::string& line, Message& message)
+{
+	while(true){
+		if(binary){
+			RequestFrame frame;
+			if(!std::cin.read(reinterpret_cast<char *>(&frame), sizeof(frame))){
+				return false;
+			}
+			if(decode_request(frame, message)){ return true; }
+			std::cerr << "malformed frame" << std::endl;
+		}else{
+			if(!std::getline(std::cin, line)){ return false; }
+			if(parser.parse(line, message)){ return true; }
+			std::cerr << "malformed message: " << line << std::endl;
 		}
 	}
-	const auto& moves = obj["moves"];
-	int num_moves = moves.size();
-	if(obj["action"] == "select"){ --num_moves; }
-	for(int step = 4; step < num_moves; ++step){
-		const auto& move = moves[step];
-		const auto& b = state.classic_board();
-		const auto p = static_cast<int>(move[0][0]);
-		const auto q = static_cast<int>(move[0][1]);
-		const auto type = static_cast<int>(move[1]);
-		if(b.get(p) || b.get(q)){ continue; }
-		const int color = 1 - 2 * (step & 1);
-		if(type < 0){ state.put(p, q, color); }
-	}
-	return state;
 }
 
-static std::pair<int, int> parse_entanglement(const nlohmann::json& obj){
-	const auto& entanglement = obj["entanglement"];
-	return std::make_pair(
-		static_cast<int>(entanglement[0]),
-		static_cast<int>(entanglement[1]));
+static void write_response(const ResponseFrame& frame){
+	std::cout.write(reinterpret_cast<const char *>(&frame), sizeof(frame));
+	std::cout.flush();
 }
 
-static std::vector<History> parse_history(const nlohmann::json& obj){
-	const auto& moves = obj["moves"];
-	int num_moves = moves.size();
-	std::vector<History> history;
-	for(int i = 0; i < num_moves; ++i){
-		const auto& move = moves[i];
-		int p = static_cast<int>(move[0][0]);
-		int q = static_cast<int>(move[0][1]);
-		int select = static_cast<int>(move[1]);
-		if(p > q){
-			std::swap(p, q);
-			if(select >= 0){ select = 1 - select; }
+int main(int argc, char *argv[]){
+	std::ios_base::sync_with_stdio(false);
+	set_seed(g_random_device());
+
+	SolverOptions options;
+	bool server = false;
+	int num_threads = static_cast<int>(std::thread::hardware_concurrency());
+	for(int i = 1; i < argc; ++i){
+		if(strcmp(argv[i], "--book") == 0 && i + 1 < argc){
+			options.book_path = argv[++i];
+		}else if(strcmp(argv[i], "--ntuple") == 0 && i + 1 < argc){
+			options.ntuple_path = argv[++i];
+		}else if(strcmp(argv[i], "--network") == 0 && i + 1 < argc){
+			options.network_path = argv[++i];
+		}else if(strcmp(argv[i], "--rollout") == 0 && i + 1 < argc){
+			options.rollout_path = argv[++i];
+		}else if(strcmp(argv[i], "--value-weight") == 0 && i + 1 < argc){
+			options.value_weight = atof(argv[++i]);
+		}else if(strcmp(argv[i], "--cutoff-plies") == 0 && i + 1 < argc){
+			options.cutoff_plies = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "--cutoff-empty") == 0 && i + 1 < argc){
+			options.cutoff_empty = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "--ntuple-leaves") == 0){
+			options.ntuple_leaves = true;
+		}else if(strcmp(argv[i], "--batch") == 0 && i + 1 < argc){
+			options.batch_size = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "--halving") == 0){
+			options.sequential_halving = true;
+		}else if(strcmp(argv[i], "--server") == 0){
+			server = true;
+		}else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc){
+			num_threads = atoi(argv[++i]);
 		}
-		history.emplace_back(p, q, select);
 	}
-	return history;
-}
+	if(server){
+		GameServer(options).run(num_threads);
+		return 0;
+	}
 
-int main(){
-	std::ios_base::sync_with_stdio(false);
-	set_seed(g_random_device());
+	ProtocolParser parser;
+	Message message;
+	std::string line;
+	line.reserve(4096);
 
-	int self_color = 0;
+	mcts::MCTSSolver solver;
+	GameTracker tracker;
+	bool binary = false;
 	{	// init
-		std::string line;
-		std::getline(std::cin, line);
-		const nlohmann::json obj = nlohmann::json::parse(line);
-		assert(obj["action"] == "init");
-		self_color = static_cast<int>(obj["index"]);
+		const bool parsed = read_message(false, parser, line, message);
+		assert(parsed && message.action == Action::INIT);
+		(void)parsed;
+		configure_solver(solver, options);
+		binary = message.binary_protocol;
+		if(binary){ std::cout << "{\"protocol\":\"binary\"}"; }
 		std::cout << std::endl;
 	}
 
-	int step = 4 + self_color;
-	mcts::MCTSSolver solver;
-	while(true){
-		std::string line;
-		std::getline(std::cin, line);
-		const nlohmann::json obj = nlohmann::json::parse(line);
-		const auto& action = obj["action"];
-		if(action == "quit"){
-			std::cout << std::endl;
+	while(read_message(binary, parser, line, message)){
+		if(message.action == Action::QUIT){
+			if(binary){
+				write_response(make_response(Action::QUIT));
+			}else{
+				std::cout << std::endl;
+			}
 			break;
-		}else if(action == "play"){
-			const auto root = parse_state(obj);
-			const auto history = parse_history(obj);
-			const auto ret = solver.play(root, step, history);
-			std::cout << "{\"positions\":[" << ret.first << "," << ret.second << "]}" << std::endl;
-			step += 2;
-		}else if(action == "select"){
-			const auto root = parse_state(obj);
-			const auto history = parse_history(obj);
-			const auto entanglement = parse_entanglement(obj);
+		}
+		if(!tracker.sync(message.moves, message.board)){
+			std::cerr << "state mismatch, rebuilt from the board" << std::endl;
+		}
+		if(message.action == Action::PLAY){
+			const auto ret = solver.play(
+				tracker.state(), tracker.step(), tracker.history());
+			if(binary){
+				write_response(make_response(Action::PLAY, ret.first, ret.second));
+			}else{
+				std::cout << "{\"positions\":[" << ret.first << "," << ret.second << "]}" << std::endl;
+			}
+			std::cerr << "{\"telemetry\":" << solver.telemetry().to_json() << "}" << std::endl;
+			stats::report(std::cerr);
+		}else if(message.action == Action::SELECT){
+			const auto& entanglement = message.entanglement;
 			const auto ret = solver.select(
-				root, entanglement.first, entanglement.second, step - 1, history);
-			std::cout << "{\"select\":" << ret << "}" << std::endl;
+				tracker.state(), entanglement.first, entanglement.second,
+				tracker.step() - 1, tracker.history());
+			if(binary){
+				write_response(make_response(Action::SELECT, 0, 0, ret));
+			}else{
+				std::cout << "{\"select\":" << ret << "}" << std::endl;
+			}
+			std::cerr << "{\"telemetry\":" << solver.telemetry().to_json() << "}" << std::endl;
+			stats::report(std::cerr);
 		}
 	}
 	return 0;
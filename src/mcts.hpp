@@ -1,13 +1,23 @@
 #pragma once
 #include <vector>
+#include <string>
 #include <limits>
+#include <sstream>
 #include <memory>
 #include <chrono>
 #include <cmath>
 #include <cassert>
+#include <atomic>
+#include <algorithm>
 #include "state.hpp"
 #include "random.hpp"
 #include "playout.hpp"
+#include "time_manager.hpp"
+#include "cancellation.hpp"
+#include "opening_book.hpp"
+#include "symmetry.hpp"
+#include "network.hpp"
+#include "leaf_evaluator.hpp"
 
 namespace mcts {
 
@@ -16,7 +26,12 @@ static constexpr int PLAYOUT_BLOCK_SIZE = 100;
 static constexpr int PLAYOUT_SCALE = 4;
 static constexpr int EXPAND_THRESHOLD = 80;
 static constexpr double TIME_LIMIT = 9.8;
-static constexpr double TIME_PER_TURN = 0.2;
+// PUCT: exploration constant and reduction of the first-play urgency
+// below the mean of the visited siblings
+static constexpr double PUCT_CONSTANT = 1.5;
+static constexpr double FPU_REDUCTION = 0.1;
+// root moves listed by the telemetry of a decision
+static constexpr int TELEMETRY_TOP_MOVES = 5;
 
 struct Move {
 	int p, q;
@@ -24,6 +39,32 @@ struct Move {
 	Move(int p, int q) : p(p), q(q) { }
 };
 
+// PLAYOUT_SCALE plain playouts per leaf
+inline const LeafEvaluator& default_leaf_evaluator(){
+	static const PlayoutLeafEvaluator instance(PlayoutCutoff(), PLAYOUT_SCALE);
+	return instance;
+}
+
+// how the leaves of a search are scored
+struct SearchSettings {
+	// when set, PUCT over its priors replaces UCB1
+	const network::Network *network;
+	const LeafEvaluator *leaf_evaluator;
+	// leaves scored together by LeafQueue; 1 scores every leaf during its
+	// descent
+	int batch_size;
+
+	SearchSettings()
+		: network(nullptr)
+		, leaf_evaluator(&default_leaf_evaluator())
+		, batch_size(1)
+	{ }
+
+	bool puct() const {
+		return network && network->is_open();
+	}
+};
+
 class MCTSNode {
 
 public:
@@ -38,8 +79,12 @@ private:
 	Move m_last_move;
 	bool m_has_entanglement;
 
-	int m_num_wins;
+	double m_num_wins;   // fractional with truncated playouts
 	int m_num_playouts;
+	// PLAYOUT_SCALE for every descent of LeafQueue through this node whose
+	// leaf waits for its score; selection counts them as lost playouts
+	int m_virtual_playouts;
+	float m_prior;       // of the move from the parent, for PUCT
 
 public:
 	MCTSNode()
@@ -49,8 +94,10 @@ public:
 		, m_last_color(0)
 		, m_last_move()
 		, m_has_entanglement(false)
-		, m_num_wins(0)
+		, m_num_wins(0.0)
 		, m_num_playouts(0)
+		, m_virtual_playouts(0)
+		, m_prior(0.0f)
 	{ }
 
 	MCTSNode(
@@ -65,29 +112,34 @@ public:
 		, m_last_color(last_color)
 		, m_last_move(last_move)
 		, m_has_entanglement(has_entanglement)
-		, m_num_wins(0)
+		, m_num_wins(0.0)
 		, m_num_playouts(0)
+		, m_virtual_playouts(0)
+		, m_prior(0.0f)
 	{ }
 
-	void expand(){
+	// leaves the node unexpanded when the token is cancelled on the way;
+	// pairs equivalent under a transform in `stabilizer` are generated once
+	void expand(CancellationToken& token, uint32_t stabilizer = 1){
 		if(!m_children.empty()){ return; }
 		const auto& board = m_state.classic_board();
 		const auto& last_move = m_last_move;
 		if(board.count(1) + board.count(-1) == 36){
 			// this is a leaf
 		}else if(m_has_entanglement){
-			// select entanglement
+			// select entanglement: the selected cell takes the stone of the
+			// player who closed the cycle
 			const int next_color = m_last_color * -1;
 			const int p = last_move.p, q = last_move.q;
 			{	// select p
 				State s = m_state;
-				s.select_entanglement(p, next_color);
+				s.select_entanglement(p, m_last_color);
 				m_children.push_back(std::make_unique<MCTSNode>(
 					this, s, next_color, Move(p, p), false));
 			}
 			{	// select q
 				State s = m_state;
-				s.select_entanglement(q, next_color);
+				s.select_entanglement(q, m_last_color);
 				m_children.push_back(std::make_unique<MCTSNode>(
 					this, s, next_color, Move(q, q), false));
 			}
@@ -114,9 +166,16 @@ public:
 			}
 			// enumerate all valid moves
 			for(int i = 0; i < pcount; ++i){
+				if(token.poll()){
+					m_children.clear();
+					return;
+				}
 				for(int j = i + 1; j < pcount; ++j){
 					const int p = std::min(plist[i], plist[j]);
 					const int q = std::max(plist[i], plist[j]);
+					if(stabilizer != 1 && !is_canonical_pair(p, q, stabilizer)){
+						continue;
+					}
 					if(m_state.test_entanglement(p, q)){
 						// entanglement
 						m_children.push_back(std::make_unique<MCTSNode>(
@@ -133,46 +192,248 @@ public:
 		}
 	}
 
-	std::array<int, 3> update(){
-		std::array<int, 3> result_counter = { 0, 0, 0 };
-		if(m_children.empty() && m_num_playouts == EXPAND_THRESHOLD){
-			expand();
+	// color of the player deciding at this node
+	int color_to_decide() const {
+		if(m_has_entanglement){ return -m_last_color; }
+		return m_last_color * (m_last_move.p == m_last_move.q ? 1 : -1);
+	}
+
+	bool is_terminal() const {
+		const auto& board = m_state.classic_board();
+		return board.count(1) + board.count(-1) == 36;
+	}
+
+	Leaf leaf() const {
+		Leaf leaf;
+		leaf.state = &m_state;
+		leaf.color = color_to_decide();
+		leaf.pending = m_has_entanglement
+			? (1ul << m_last_move.p) | (1ul << m_last_move.q) : 0ul;
+		return leaf;
+	}
+
+	// a terminal node by its outcome, any other by the leaf evaluator
+	LeafScore score(const SearchSettings& settings) const {
+		LeafScore result = { 0.0, 0.0, 0.0 };
+		if(is_terminal()){
+			result[playout(m_state) + 1] = 1.0;
+		}else{
+			const Leaf l = leaf();
+			settings.leaf_evaluator->evaluate(&l, 1, &result);
 		}
-		if(m_children.empty()){
-			// random playout
-			for(int i = 0; i < PLAYOUT_SCALE; ++i){
-				++result_counter[playout(m_state) + 1];
+		return result;
+	}
+
+	void evaluate(const network::Network& network, network::Output& out) const {
+		const Leaf l = leaf();
+		network.evaluate(m_state, l.color, l.pending, out);
+	}
+
+	// sets the priors of the children from the policy of the network
+	void assign_priors(const network::Network& network){
+		if(m_children.empty()){ return; }
+		network::Output out;
+		evaluate(network, out);
+		std::vector<float> logits(m_children.size());
+		float max_logit = -std::numeric_limits<float>::infinity();
+		for(size_t i = 0; i < m_children.size(); ++i){
+			const auto& move = m_children[i]->m_last_move;
+			logits[i] = m_has_entanglement
+				? out.selection[move.p]
+				: out.placement[move.p] + out.placement[move.q];
+			max_logit = std::max(max_logit, logits[i]);
+		}
+		float sum = 0.0f;
+		for(auto& x : logits){
+			x = std::exp(x - max_logit);
+			sum += x;
+		}
+		for(size_t i = 0; i < m_children.size(); ++i){
+			m_children[i]->m_prior = logits[i] / sum;
+		}
+	}
+
+	// playouts including the virtual ones
+	int visits() const {
+		return m_num_playouts + m_virtual_playouts;
+	}
+
+	// child maximizing Q + c * P * sqrt(N) / (1 + n), counting visits of
+	// PLAYOUT_SCALE playouts
+	MCTSNode *select_puct() const {
+		double visited_wins = 0.0;
+		int visited_playouts = 0;
+		for(const auto& child : m_children){
+			visited_wins += child->m_num_wins;
+			visited_playouts += child->visits();
+		}
+		const double fpu = (visited_playouts > 0
+			? visited_wins / visited_playouts : 0.5) - FPU_REDUCTION;
+		const double exploration =
+			PUCT_CONSTANT * sqrt(std::max(1, visits() / PLAYOUT_SCALE));
+		double best_score = -std::numeric_limits<double>::infinity();
+		MCTSNode *best_node = nullptr;
+		for(const auto& child : m_children){
+			const int n = child->visits();
+			const double q = n > 0 ? child->m_num_wins / n : fpu;
+			const double score =
+				q + exploration * child->m_prior / (1 + n / PLAYOUT_SCALE);
+			if(score > best_score){
+				best_score = score;
+				best_node = child.get();
+			}
+		}
+		return best_node;
+	}
+
+	// UCB1 child; the unprocessed children come first
+	MCTSNode *select_ucb() const {
+		const int total_playouts = visits();
+		if(total_playouts < m_children.size()){
+			return m_children[total_playouts].get();
+		}
+		double best_score = -std::numeric_limits<double>::infinity();
+		MCTSNode *best_node = nullptr;
+		for(auto& child : m_children){
+			const auto score = child->ucb_score(total_playouts);
+			if(score > best_score){
+				best_score = score;
+				best_node = child.get();
 			}
-		}else if(m_num_playouts < m_children.size()){
-			// run playout on unprocessed node
-			result_counter = m_children[m_num_playouts]->update();
+		}
+		return best_node;
+	}
+
+	// adds a score of weight PLAYOUT_SCALE to `result_counter`
+	static void add_score(const LeafScore& score, std::array<double, 3>& result_counter){
+		for(int i = 0; i < 3; ++i){ result_counter[i] += score[i] * PLAYOUT_SCALE; }
+	}
+
+	std::array<double, 3> update_puct(CancellationToken& token, const SearchSettings& settings){
+		std::array<double, 3> result_counter = { 0.0, 0.0, 0.0 };
+		if(token.poll()){ return result_counter; }
+		if(is_terminal()){
+			add_score(score(settings), result_counter);
 		}else{
-			// count number of playouts in this subtree
-			int total_playouts = m_num_playouts;
-			// select a node having best UCB1 score
-			double best_score = -std::numeric_limits<double>::infinity();
-			MCTSNode *best_node = nullptr;
-			for(auto& child : m_children){
-				const auto score = child->ucb_score(total_playouts);
-				if(score > best_score){
-					best_score = score;
-					best_node = child.get();
-				}
+			if(m_children.empty() && m_num_playouts >= EXPAND_THRESHOLD){
+				expand(token);
+				if(token.cancelled()){ return result_counter; }
+				assign_priors(*settings.network);
+			}
+			if(m_children.empty()){
+				add_score(score(settings), result_counter);
+			}else{
+				result_counter = select_puct()->update(token, settings);
 			}
-			// run playout
-			result_counter = best_node->update();
+		}
+		if(result_counter[0] + result_counter[1] + result_counter[2] == 0){
+			return result_counter;
+		}
+		m_num_playouts += PLAYOUT_SCALE;
+		m_num_wins += result_counter[m_last_color + 1];
+		return result_counter;
+	}
+
+	// returns all zeros without touching any statistics when cancelled; a
+	// leaf adds its score times PLAYOUT_SCALE to the counts of outcomes
+	std::array<double, 3> update(
+		CancellationToken& token, const SearchSettings& settings = SearchSettings())
+	{
+		if(settings.puct()){ return update_puct(token, settings); }
+		std::array<double, 3> result_counter = { 0.0, 0.0, 0.0 };
+		if(token.poll()){ return result_counter; }
+		if(m_children.empty() && m_num_playouts == EXPAND_THRESHOLD){
+			expand(token);
+			if(token.cancelled()){ return result_counter; }
+		}
+		if(m_children.empty()){
+			add_score(score(settings), result_counter);
+		}else{
+			result_counter = select_ucb()->update(token, settings);
+		}
+		if(result_counter[0] + result_counter[1] + result_counter[2] == 0){
+			return result_counter;
+		}
+		m_num_playouts += PLAYOUT_SCALE;
+		m_num_wins += result_counter[m_last_color + 1];
+		return result_counter;
+	}
+
+	// runs one update through the specified child
+	std::array<double, 3> update_child(
+		size_t index, CancellationToken& token, const SearchSettings& settings = SearchSettings())
+	{
+		const auto result_counter = m_children[index]->update(token, settings);
+		if(result_counter[0] + result_counter[1] + result_counter[2] == 0){
+			return result_counter;
 		}
 		m_num_playouts += PLAYOUT_SCALE;
 		m_num_wins += result_counter[m_last_color + 1];
 		return result_counter;
 	}
 
+	// LeafQueue: descends like update(), from the child `child` unless it
+	// is negative, and adds PLAYOUT_SCALE virtual playouts to every node on
+	// the way. Returns the leaf to score, or null when cancelled; the
+	// virtual playouts are taken back then.
+	MCTSNode *select_leaf(CancellationToken& token, const SearchSettings& settings, int child = -1){
+		MCTSNode *node = this;
+		if(child >= 0){
+			m_virtual_playouts += PLAYOUT_SCALE;
+			node = m_children[child].get();
+		}
+		while(true){
+			if(token.poll()){
+				release(node->m_parent);
+				return nullptr;
+			}
+			if(node->m_children.empty() && node->m_num_playouts >= EXPAND_THRESHOLD){
+				node->expand(token);
+				if(token.cancelled()){
+					release(node->m_parent);
+					return nullptr;
+				}
+				if(settings.puct()){ node->assign_priors(*settings.network); }
+			}
+			MCTSNode *next = nullptr;
+			if(!node->m_children.empty()){
+				next = settings.puct() ? node->select_puct() : node->select_ucb();
+			}
+			node->m_virtual_playouts += PLAYOUT_SCALE;
+			if(!next){ return node; }
+			node = next;
+		}
+	}
+
+	// takes back the virtual playouts of a descent from `node` up
+	static void release(MCTSNode *node){
+		for(; node; node = node->m_parent){
+			node->m_virtual_playouts -= PLAYOUT_SCALE;
+		}
+	}
+
+	// adds the score of a leaf of select_leaf() to it and its ancestors in
+	// place of their virtual playouts
+	void backup(const LeafScore& score){
+		for(MCTSNode *node = this; node; node = node->m_parent){
+			node->m_virtual_playouts -= PLAYOUT_SCALE;
+			node->m_num_playouts += PLAYOUT_SCALE;
+			node->m_num_wins += score[node->m_last_color + 1] * PLAYOUT_SCALE;
+		}
+	}
+
+	double win_rate() const {
+		if(m_num_playouts == 0){ return -1.0; }
+		return m_num_wins / m_num_playouts;
+	}
+
 	double ucb_score(int total_playouts) const {
-		if(m_num_playouts == 0){
+		const int n = visits();
+		if(n == 0){
 			return std::numeric_limits<double>::infinity();
 		}
-		const double r = static_cast<double>(m_num_wins) / m_num_playouts;
-		const double x = log(total_playouts) / m_num_playouts;
+		const double r = m_num_wins / n;
+		const double x = log(total_playouts) / n;
 		const double y = std::min(0.25, r - r * r + sqrt(2.0 * x));
 		return r + sqrt(x * y);
 	}
@@ -181,7 +442,7 @@ public:
 		return m_last_move;
 	}
 
-	int num_wins() const {
+	double num_wins() const {
 		return m_num_wins;
 	}
 
@@ -189,13 +450,21 @@ public:
 		return m_num_playouts;
 	}
 
+	float prior() const {
+		return m_prior;
+	}
+
+	const std::vector<pointer_type>& children() const {
+		return m_children;
+	}
+
 	Move select_best_move() const {
 		if(m_children.empty()){ return Move(-1, -1); }
 		double best_score = -std::numeric_limits<double>::infinity();
-		MCTSNode *best_node = nullptr;
+		MCTSNode *best_node = m_children.front().get();
 		for(auto& child : m_children){
-			const auto score =
-				static_cast<double>(child->num_wins()) / child->num_playouts();
+			if(child->num_playouts() == 0){ continue; }
+			const auto score = child->num_wins() / child->num_playouts();
 			if(score > best_score){
 				best_score = score;
 				best_node = child.get();
@@ -204,33 +473,693 @@ public:
 		return best_node->m_last_move;
 	}
 
+	// the choice of PUCT, which visits good moves the most
+	Move most_visited_move() const {
+		if(m_children.empty()){ return Move(-1, -1); }
+		const MCTSNode *best_node = m_children.front().get();
+		for(const auto& child : m_children){
+			if(child->num_playouts() > best_node->num_playouts()){ best_node = child.get(); }
+		}
+		return best_node->m_last_move;
+	}
+
+};
+
+// Batched leaf evaluation: descents leave their leaves here under virtual
+// playouts and go on, and once `batch_size` leaves are waiting the leaf
+// evaluator scores them in one call and the scores are backed up. Terminal
+// leaves are backed up at once. With a batch size of 1 every push is a
+// plain MCTSNode::update().
+class LeafQueue {
+
+private:
+	const SearchSettings& m_settings;
+	int m_batch_size;
+	std::array<MCTSNode *, MAX_LEAF_BATCH> m_nodes;
+	std::array<Leaf, MAX_LEAF_BATCH> m_leaves;
+	std::array<LeafScore, MAX_LEAF_BATCH> m_scores;
+	int m_num_leaves;
+
+public:
+	explicit LeafQueue(const SearchSettings& settings)
+		: m_settings(settings)
+		, m_batch_size(std::max(1, std::min(MAX_LEAF_BATCH, settings.batch_size)))
+		, m_nodes()
+		, m_leaves()
+		, m_scores()
+		, m_num_leaves(0)
+	{ }
+
+	LeafQueue(const LeafQueue&) = delete;
+	LeafQueue& operator=(const LeafQueue&) = delete;
+
+	// the waiting leaves are scored, so that no virtual playouts remain
+	~LeafQueue(){
+		flush();
+	}
+
+	// one descent from `root`, through its child `child` unless it is
+	// negative
+	void push(MCTSNode& root, CancellationToken& token, int child = -1){
+		if(m_batch_size == 1){
+			if(child < 0){
+				root.update(token, m_settings);
+			}else{
+				root.update_child(child, token, m_settings);
+			}
+			return;
+		}
+		MCTSNode *node = root.select_leaf(token, m_settings, child);
+		if(!node){ return; }
+		if(node->is_terminal()){
+			node->backup(node->score(m_settings));
+			return;
+		}
+		m_nodes[m_num_leaves] = node;
+		m_leaves[m_num_leaves] = node->leaf();
+		if(++m_num_leaves == m_batch_size){ flush(); }
+	}
+
+	// scores and backs up the waiting leaves
+	void flush(){
+		if(m_num_leaves == 0){ return; }
+		m_settings.leaf_evaluator->evaluate(m_leaves.data(), m_num_leaves, m_scores.data());
+		for(int i = 0; i < m_num_leaves; ++i){ m_nodes[i]->backup(m_scores[i]); }
+		m_num_leaves = 0;
+	}
+
+};
+
+struct RootStatistics {
+	Move move;
+	double num_wins;
+	int num_playouts;
+	RootStatistics() : move(), num_wins(0.0), num_playouts(0) { }
+	RootStatistics(const Move& m, double w, int n) : move(m), num_wins(w), num_playouts(n) { }
+};
+
+// what ended a search
+enum class StopReason {
+	NONE,           // no search: a book move or a shortcut
+	SINGLE_MOVE,    // at most one candidate
+	DEADLINE,
+	CANCELLED,      // by MCTSSolver::cancel()
+	DECIDED,        // the runner-up could not catch up any more
+	PLAYOUT_LIMIT,
+	ROUNDS_DONE     // sequential halving finished its rounds
+};
+
+inline const char *to_string(StopReason reason){
+	switch(reason){
+	case StopReason::SINGLE_MOVE:   return "single_move";
+	case StopReason::DEADLINE:      return "deadline";
+	case StopReason::CANCELLED:     return "cancelled";
+	case StopReason::DECIDED:       return "decided";
+	case StopReason::PLAYOUT_LIMIT: return "playout_limit";
+	case StopReason::ROUNDS_DONE:   return "rounds_done";
+	default:                        return "none";
+	}
+}
+
+// summary of the search of one decision
+struct SearchTelemetry {
+	const char *decision;     // "play" or "select"
+	int step;
+	int root_playouts;
+	double search_time;       // seconds
+	double total_time;        // including freeing the tree, charged to the clock
+	double budget;
+	double wait_time;         // the request waited before the solver got it
+	double remaining_time;    // on the clock after the decision
+	size_t num_nodes;
+	size_t num_bytes;         // of the nodes and their child lists
+	int max_depth;
+	double average_depth;     // of the leaves
+	StopReason stop_reason;
+	std::vector<RootStatistics> top_moves;  // most visited first
+
+	SearchTelemetry()
+		: decision("play")
+		, step(0)
+		, root_playouts(0)
+		, search_time(0.0)
+		, total_time(0.0)
+		, budget(0.0)
+		, wait_time(0.0)
+		, remaining_time(0.0)
+		, num_nodes(0)
+		, num_bytes(0)
+		, max_depth(0)
+		, average_depth(0.0)
+		, stop_reason(StopReason::NONE)
+		, top_moves()
+	{ }
+
+	// a JSON object on one line
+	std::string to_json() const {
+		std::ostringstream oss;
+		const double rate = search_time > 0.0 ? root_playouts / search_time : 0.0;
+		oss << "{\"decision\":\"" << decision << "\",\"step\":" << step
+		    << ",\"root_playouts\":" << root_playouts
+		    << ",\"playouts_per_second\":" << static_cast<int64_t>(rate)
+		    << ",\"nodes\":" << num_nodes << ",\"bytes\":" << num_bytes
+		    << ",\"max_depth\":" << max_depth << ",\"average_depth\":" << average_depth
+		    << ",\"search_time\":" << search_time << ",\"total_time\":" << total_time
+		    << ",\"budget\":" << budget << ",\"wait_time\":" << wait_time
+		    << ",\"remaining_time\":" << remaining_time
+		    << ",\"stop_reason\":\"" << to_string(stop_reason) << "\",\"top_moves\":[";
+		for(size_t i = 0; i < top_moves.size(); ++i){
+			const auto& m = top_moves[i];
+			oss << (i ? "," : "") << "{\"positions\":[" << m.move.p << "," << m.move.q
+			    << "],\"visits\":" << m.num_playouts << ",\"win_rate\":"
+			    << (m.num_playouts > 0 ? m.num_wins / m.num_playouts : 0.0) << "}";
+		}
+		oss << "]}";
+		return oss.str();
+	}
+};
+
+class SequentialHalving {
+
+private:
+	std::vector<size_t> m_candidates;
+	int m_num_rounds;
+
+	void sort_candidates(const MCTSNode& root){
+		const auto& children = root.children();
+		std::stable_sort(
+			m_candidates.begin(), m_candidates.end(),
+			[&children](size_t a, size_t b){
+				return children[a]->win_rate() > children[b]->win_rate();
+			});
+	}
+
+public:
+	SequentialHalving()
+		: m_candidates()
+		, m_num_rounds(0)
+	{ }
+
+	// picks `num_sampled` candidates uniformly at random without
+	// replacement (all when zero)
+	void initialize(const MCTSNode& root, size_t num_sampled){
+		const size_t n = root.children().size();
+		m_candidates.resize(n);
+		for(size_t i = 0; i < n; ++i){ m_candidates[i] = i; }
+		if(num_sampled > 0 && num_sampled < n){
+			for(size_t i = 0; i < num_sampled; ++i){
+				const size_t j = i + modulus_random(static_cast<uint32_t>(n - i));
+				std::swap(m_candidates[i], m_candidates[j]);
+			}
+			m_candidates.resize(num_sampled);
+		}
+		m_num_rounds = 0;
+		while((static_cast<size_t>(1) << m_num_rounds) < m_candidates.size()){
+			++m_num_rounds;
+		}
+	}
+
+	// ceil(log2(n)) for n candidates
+	int num_rounds() const {
+		return m_num_rounds;
+	}
+
+	// best surviving candidate
+	Move best_move(const MCTSNode& root) const {
+		const auto& children = root.children();
+		size_t best = m_candidates.front();
+		for(const auto i : m_candidates){
+			if(children[i]->win_rate() > children[best]->win_rate()){ best = i; }
+		}
+		return children[best]->last_move();
+	}
+
+	// true when `remaining_playouts` further playouts can not change the
+	// best surviving candidate: its win rate after losing all of them stays
+	// above the win rate of every other one after winning all of them
+	bool is_decided(const MCTSNode& root, double remaining_playouts) const {
+		const auto& children = root.children();
+		const MCTSNode& best = *children[m_candidates.front()];
+		if(best.num_playouts() == 0){ return false; }
+		const double worst = best.num_wins() / (best.num_playouts() + remaining_playouts);
+		for(const auto i : m_candidates){
+			const auto& child = *children[i];
+			if(&child == &best){ continue; }
+			const double n = child.num_playouts() + remaining_playouts;
+			if(n <= 0.0 || (child.num_wins() + remaining_playouts) / n >= worst){ return false; }
+		}
+		return true;
+	}
+
+	// round `round` of num_rounds(): spends an equal share of the time
+	// until `break_time` (and of the root playouts up to `max_playouts`
+	// unless it is zero) visiting the candidates round-robin, then drops the
+	// worse half of them; false when the token cancelled it
+	bool run_round(
+		MCTSNode& root,
+		int round,
+		std::chrono::steady_clock::time_point break_time,
+		CancellationToken& token,
+		int max_playouts = 0,
+		const SearchSettings& settings = SearchSettings())
+	{
+		const auto now = std::chrono::steady_clock::now();
+		const auto round_time = now + (break_time - now) / (m_num_rounds - round);
+		const int round_playouts = root.num_playouts() +
+			(max_playouts - root.num_playouts()) / (m_num_rounds - round);
+		bool finished = false;
+		LeafQueue queue(settings);
+		while(!finished){
+			for(const auto index : m_candidates){
+				queue.push(root, token, static_cast<int>(index));
+			}
+			if(token.cancelled()){ return false; }
+			finished = (std::chrono::steady_clock::now() >= round_time) ||
+				(max_playouts > 0 && root.num_playouts() >= round_playouts);
+		}
+		queue.flush();
+		sort_candidates(root);
+		m_candidates.resize((m_candidates.size() + 1) / 2);
+		return true;
+	}
+
 };
 
 class MCTSSolver {
 
+public:
+	enum class RootPolicy {
+		UCB,
+		SEQUENTIAL_HALVING
+	};
+
+	// what scores the leaves besides the value of the network
+	enum class LeafEvaluation {
+		PLAYOUTS,
+		NTUPLE
+	};
+
+
 private:
-	std::chrono::duration<double> m_remaining_time;
+	TimeManager m_time_manager;
+	CancellationToken m_token;
+	// anytime result of the running search (p | q << 8, NO_SNAPSHOT without
+	// a move)
+	static constexpr int NO_SNAPSHOT = -1;
+	std::atomic<int> m_snapshot;
+	RootPolicy m_root_policy;
+	size_t m_num_sampled;
+	std::vector<RootStatistics> m_root_statistics;
+	StopReason m_stop_reason;
+	SearchTelemetry m_telemetry;
+	OpeningBook m_book;
+	ntuple::Evaluator m_evaluator;
+	network::Network m_network;
+	rollout::Policy m_rollout_policy;
+	PlayoutCutoff m_cutoff;
+	LeafEvaluation m_leaf_evaluation;
+	double m_value_weight;
+	// the leaf evaluators in use, rebuilt by configure_leaves()
+	std::vector<std::unique_ptr<LeafEvaluator>> m_leaf_evaluators;
+	SearchSettings m_settings;
 
-	void update_loop(MCTSNode& root){
-		const auto start_time = std::chrono::steady_clock::now();
-		const auto break_time = start_time + m_remaining_time * TIME_PER_TURN;
-		auto last_time = start_time;
-		int debug = 0;
-		do {
-			for(int i = 0; i < PLAYOUT_BLOCK_SIZE; ++i){ root.update(); ++debug; }
-			last_time = std::chrono::steady_clock::now();
-		} while(last_time < break_time);
-		m_remaining_time -= last_time - start_time;
+	// the n-tuple evaluator or playouts score the leaves, mixed with the
+	// value of the network for PUCT
+	void configure_leaves(){
+		m_leaf_evaluators.clear();
+		if(m_leaf_evaluation == LeafEvaluation::NTUPLE && m_evaluator.is_open()){
+			m_leaf_evaluators.emplace_back(new NTupleLeafEvaluator(m_evaluator));
+		}else{
+			m_leaf_evaluators.emplace_back(
+				new PlayoutLeafEvaluator(m_cutoff, PLAYOUT_SCALE, &m_rollout_policy));
+		}
+		if(m_settings.puct() && m_value_weight > 0.0){
+			const LeafEvaluator& base = *m_leaf_evaluators.back();
+			m_leaf_evaluators.emplace_back(new NetworkLeafEvaluator(m_network));
+			if(m_value_weight < 1.0){
+				const LeafEvaluator& value = *m_leaf_evaluators.back();
+				m_leaf_evaluators.emplace_back(new MixedLeafEvaluator(value, base, m_value_weight));
+			}
+		}
+		m_settings.leaf_evaluator = m_leaf_evaluators.back().get();
+	}
+
+	void store_snapshot(const Move& move){
+		const int packed =
+			move.p < 0 ? NO_SNAPSHOT : (move.p & 0xff) | ((move.q & 0xff) << 8);
+		m_snapshot.store(packed, std::memory_order_relaxed);
+	}
+
+	Move best_move(const MCTSNode& root) const {
+		return m_settings.puct() ? root.most_visited_move() : root.select_best_move();
+	}
+
+	// true when the most visited child is also the best one and can not be
+	// overtaken by the runner-up with `remaining_playouts` further playouts
+	bool is_decided(const MCTSNode& root, double remaining_playouts) const {
+		const MCTSNode *first = nullptr, *second = nullptr;
+		for(const auto& child : root.children()){
+			if(!first || child->num_playouts() > first->num_playouts()){
+				second = first;
+				first = child.get();
+			}else if(!second || child->num_playouts() > second->num_playouts()){
+				second = child.get();
+			}
+		}
+		if(!first || !second){ return true; }
+		const auto best = best_move(root);
+		if(best.p != first->last_move().p || best.q != first->last_move().q){
+			return false;
+		}
+		return TimeManager::is_decided(
+			first->num_playouts(), second->num_playouts(), remaining_playouts);
+	}
+
+	// searches until `start_time + budget` or until the root has
+	// `max_playouts` playouts (unless it is zero) without charging the
+	// game clock
+	void search(
+		MCTSNode& root,
+		std::chrono::steady_clock::time_point start_time,
+		TimeManager::duration_type budget,
+		int max_playouts = 0)
+	{
+		const int playout_limit =
+			max_playouts > 0 ? max_playouts : std::numeric_limits<int>::max();
+		const auto break_time = start_time +
+			std::chrono::duration_cast<std::chrono::steady_clock::duration>(budget);
+		m_token.reset(break_time);
+		// the token also cancels itself at the deadline
+		const auto cancel_reason = [break_time]{
+			return std::chrono::steady_clock::now() >= break_time
+				? StopReason::DEADLINE : StopReason::CANCELLED;
+		};
+		m_stop_reason = StopReason::SINGLE_MOVE;
+		if(m_settings.puct()){ root.assign_priors(m_network); }
+		store_snapshot(best_move(root));
+		if(m_root_policy == RootPolicy::SEQUENTIAL_HALVING &&
+		   root.children().size() > 2)
+		{
+			SequentialHalving halving;
+			halving.initialize(root, m_num_sampled);
+			m_stop_reason = StopReason::ROUNDS_DONE;
+			for(int round = 0; round < halving.num_rounds(); ++round){
+				const bool finished = halving.run_round(
+					root, round, break_time, m_token, max_playouts, m_settings);
+				store_snapshot(halving.best_move(root));
+				if(!finished){
+					m_stop_reason = cancel_reason();
+					break;
+				}
+				const auto now = std::chrono::steady_clock::now();
+				const std::chrono::duration<double> elapsed = now - start_time;
+				const std::chrono::duration<double> left = break_time - now;
+				const double rate = root.num_playouts() / std::max(elapsed.count(), 1e-9);
+				const double remaining = std::max(0.0, std::min<double>(
+					rate * left.count(), playout_limit - root.num_playouts()));
+				if(halving.is_decided(root, remaining)){
+					m_stop_reason = StopReason::DECIDED;
+					break;
+				}
+			}
+			if(m_stop_reason == StopReason::ROUNDS_DONE && root.num_playouts() >= playout_limit){
+				m_stop_reason = StopReason::PLAYOUT_LIMIT;
+			}
+		}else if(root.children().size() > 1){
+			LeafQueue queue(m_settings);
+			m_stop_reason = StopReason::PLAYOUT_LIMIT;
+			// the first block skips the checks of the loop below; it still
+			// stops once the token is cancelled, so a zero or expired budget
+			// may leave the root without playouts
+			for(int i = 0; i < PLAYOUT_BLOCK_SIZE; ++i){
+				if(root.num_playouts() >= playout_limit){ break; }
+				queue.push(root, m_token);
+			}
+			queue.flush();
+			for(int i = 1; ; ++i){
+				if(m_token.cancelled()){
+					m_stop_reason = cancel_reason();
+					break;
+				}
+				if(root.num_playouts() >= playout_limit){ break; }
+				queue.push(root, m_token);
+				if(i % PLAYOUT_BLOCK_SIZE != 0){ continue; }
+				store_snapshot(best_move(root));
+				const auto now = std::chrono::steady_clock::now();
+				const std::chrono::duration<double> elapsed = now - start_time;
+				const std::chrono::duration<double> left = break_time - now;
+				const double rate = root.num_playouts() / elapsed.count();
+				const double remaining = std::min<double>(
+					rate * left.count(), playout_limit - root.num_playouts());
+				if(is_decided(root, remaining)){
+					m_stop_reason = StopReason::DECIDED;
+					break;
+				}
+			}
+			queue.flush();
+			store_snapshot(best_move(root));
+		}
+		m_root_statistics.clear();
+		for(const auto& child : root.children()){
+			m_root_statistics.emplace_back(
+				child->last_move(), child->num_wins(), child->num_playouts());
+		}
+	}
+
+	// adds the nodes below `node` at `depth` to the telemetry; the depths
+	// of the leaves are summed in average_depth
+	static void measure_tree(
+		const MCTSNode& node, int depth, SearchTelemetry& telemetry, size_t& num_leaves)
+	{
+		const auto& children = node.children();
+		++telemetry.num_nodes;
+		telemetry.num_bytes +=
+			sizeof(MCTSNode) + children.capacity() * sizeof(MCTSNode::pointer_type);
+		telemetry.max_depth = std::max(telemetry.max_depth, depth);
+		if(children.empty()){
+			telemetry.average_depth += depth;
+			++num_leaves;
+		}
+		for(const auto& child : children){
+			measure_tree(*child, depth + 1, telemetry, num_leaves);
+		}
+	}
+
+	// the clock is charged for freeing the tree as well, which takes a
+	// while for the large trees of PUCT; m_telemetry gets the decision and
+	// step from the caller and the rest here
+	void update_loop(
+		std::unique_ptr<MCTSNode> root,
+		std::chrono::steady_clock::time_point start_time,
+		TimeManager::duration_type budget)
+	{
+		search(*root, start_time, budget);
+		const std::chrono::duration<double> search_time =
+			std::chrono::steady_clock::now() - start_time;
+		auto& telemetry = m_telemetry;
+		telemetry.root_playouts = root->num_playouts();
+		telemetry.search_time = search_time.count();
+		telemetry.budget = budget.count();
+		telemetry.stop_reason = m_stop_reason;
+		size_t num_leaves = 0;
+		measure_tree(*root, 0, telemetry, num_leaves);
+		if(num_leaves > 0){ telemetry.average_depth /= num_leaves; }
+		telemetry.top_moves = m_root_statistics;
+		std::stable_sort(
+			telemetry.top_moves.begin(), telemetry.top_moves.end(),
+			[](const RootStatistics& a, const RootStatistics& b){
+				return a.num_playouts > b.num_playouts;
+			});
+		if(telemetry.top_moves.size() > static_cast<size_t>(TELEMETRY_TOP_MOVES)){
+			telemetry.top_moves.resize(TELEMETRY_TOP_MOVES);
+		}
+		root.reset();
+		const std::chrono::duration<double> total_time =
+			std::chrono::steady_clock::now() - start_time;
+		m_time_manager.consume(total_time);
+		telemetry.total_time = total_time.count();
+		telemetry.remaining_time = m_time_manager.remaining_time().count();
+	}
+
+	// starts the telemetry of a decision and charges the clock for the time
+	// since `received`; the telemetry stays so when no search runs
+	void start_decision(
+		const char *decision, int step, std::chrono::steady_clock::time_point received)
+	{
+		const std::chrono::duration<double> wait = std::chrono::steady_clock::now() - received;
+		m_time_manager.consume(wait);
+		m_telemetry = SearchTelemetry();
+		m_telemetry.decision = decision;
+		m_telemetry.step = step;
+		m_telemetry.wait_time = wait.count();
+		m_telemetry.remaining_time = m_time_manager.remaining_time().count();
+	}
+
+	static std::unique_ptr<MCTSNode> create_root(
+		const State& root, int color, Move last_move, bool has_entanglement)
+	{
+		auto node = std::make_unique<MCTSNode>(
+			nullptr, root, color, last_move, has_entanglement);
+		// the root is always expanded completely, without symmetric duplicates
+		CancellationToken token;
+		node->expand(token, has_entanglement ? 1u : symmetry_stabilizer(root));
+		return node;
 	}
 
 public:
 	MCTSSolver()
-		: m_remaining_time(TIME_LIMIT)
-	{ }
+		: m_time_manager(TIME_LIMIT)
+		, m_token()
+		, m_snapshot(NO_SNAPSHOT)
+		, m_root_policy(RootPolicy::UCB)
+		, m_num_sampled(0)
+		, m_root_statistics()
+		, m_stop_reason(StopReason::NONE)
+		, m_telemetry()
+		, m_book()
+		, m_evaluator()
+		, m_network()
+		, m_rollout_policy()
+		, m_cutoff()
+		, m_leaf_evaluation(LeafEvaluation::PLAYOUTS)
+		, m_value_weight(0.0)
+		, m_leaf_evaluators()
+		, m_settings()
+	{
+		m_cutoff.evaluator = &m_evaluator;
+		m_settings.network = &m_network;
+		configure_leaves();
+	}
+
+	bool load_book(const char *path){
+		return m_book.open(path);
+	}
+
+	// n-tuple weights scoring truncated playouts or the leaves themselves
+	bool load_evaluator(const char *path){
+		const bool ok = m_evaluator.open(path);
+		configure_leaves();
+		return ok;
+	}
+
+	// playouts stop after `max_plies` random moves or at `stop_empty` empty
+	// cells once an evaluator is loaded; zero disables a limit
+	void set_playout_cutoff(int max_plies, int stop_empty){
+		m_cutoff.max_plies = max_plies;
+		m_cutoff.stop_empty = stop_empty;
+		configure_leaves();
+	}
+
+	// rollout policy of the playouts of the leaves (default: uniform)
+	bool load_rollout_policy(const char *path){
+		const bool ok = m_rollout_policy.open(path);
+		configure_leaves();
+		return ok;
+	}
+
+	// NTUPLE scores the leaves by the n-tuple evaluator alone, once it is
+	// loaded (default PLAYOUTS)
+	void set_leaf_evaluation(LeafEvaluation evaluation){
+		m_leaf_evaluation = evaluation;
+		configure_leaves();
+	}
+
+	// policy/value network; once loaded, searches use PUCT
+	bool load_network(const char *path){
+		const bool ok = m_network.open(path);
+		configure_leaves();
+		return ok;
+	}
 
+	// share of the network value in the leaf scores of PUCT (default 0:
+	// playouts only)
+	void set_value_weight(double weight){
+		m_value_weight = std::max(0.0, std::min(1.0, weight));
+		configure_leaves();
+	}
+
+	// leaves scored together, up to MAX_LEAF_BATCH (default 1: every leaf
+	// during its descent)
+	void set_batch_size(int batch_size){
+		m_settings.batch_size = std::max(1, std::min(MAX_LEAF_BATCH, batch_size));
+	}
+
+	// root policy of placements (default UCB); `num_sampled` limits the
+	// number of root candidates of sequential halving
+	void set_root_policy(RootPolicy policy, size_t num_sampled = 0){
+		m_root_policy = policy;
+		m_num_sampled = num_sampled;
+	}
+
+	// stops the running search; it returns its current best move
+	void cancel(){
+		m_token.cancel();
+	}
+
+	// Move(-1, -1) before the first search and for a root without moves
+	Move best_move_snapshot() const {
+		const int packed = m_snapshot.load(std::memory_order_relaxed);
+		if(packed == NO_SNAPSHOT){ return Move(-1, -1); }
+		return Move(packed & 0xff, (packed >> 8) & 0xff);
+	}
+
+	// statistics of the root children of the last search
+	const std::vector<RootStatistics>& root_statistics() const {
+		return m_root_statistics;
+	}
+
+	// summary of the last play() or select()
+	const SearchTelemetry& telemetry() const {
+		return m_telemetry;
+	}
+
+	// searches a placement for `budget` or `max_playouts` root playouts
+	// (unless it is zero) without charging the game clock
+	Move analyze(
+		const State& root, int step,
+		TimeManager::duration_type budget, int max_playouts = 0)
+	{
+		const auto start_time = std::chrono::steady_clock::now();
+		const int color = 1 - 2 * (step & 1);
+		auto node = create_root(root, color, Move(), false);
+		search(*node, start_time, budget, max_playouts);
+		return best_move_snapshot();
+	}
+
+	// same as analyze() for the selection after move `step` closed a cycle
+	int analyze_select(
+		const State& root, int p, int q, int step,
+		TimeManager::duration_type budget, int max_playouts = 0)
+	{
+		const auto start_time = std::chrono::steady_clock::now();
+		const int color = 1 - 2 * (step & 1);
+		auto node = create_root(root, color, Move(p, q), true);
+		search(*node, start_time, budget, max_playouts);
+		return best_move_snapshot().p;
+	}
+
+	// starts a new game: a full clock and nothing left of the last one
+	void new_game(){
+		m_time_manager = TimeManager(TIME_LIMIT);
+		store_snapshot(Move(-1, -1));
+		m_root_statistics.clear();
+		m_telemetry = SearchTelemetry();
+	}
+
+	// `received` is when the request arrived; the time it waited before it
+	// got here counts against the clock as well
 	std::pair<int, int> play(
-		const State& root, int step, const std::vector<History>& history)
+		const State& root, int step, const std::vector<History>& history,
+		std::chrono::steady_clock::time_point received = std::chrono::steady_clock::now())
 	{
+		start_decision("play", step, received);
+		int book_p = 0, book_q = 0;
+		if(m_book.find(root, book_p, book_q)){
+			const auto& board = root.classic_board();
+			if(book_p < book_q && board.get(book_p) == 0 && board.get(book_q) == 0){
+				return std::make_pair(book_p, book_q);
+			}
+		}
 		if(step == 4){
 			// shortcut: first step
 			return std::make_pair(0, 35);
@@ -250,25 +1179,28 @@ public:
 				if(used[p.first] == 0 && used[p.second] == 0){ return p; }
 			}
 		}
+		const auto start_time = std::chrono::steady_clock::now();
 		const int color = 1 - 2 * (step & 1);
-		auto node = std::make_unique<MCTSNode>(
-			nullptr, root, color, Move(), false);
-		node->expand();
-		update_loop(*node);
-		const auto best = node->select_best_move();
+		auto node = create_root(root, color, Move(), false);
+		const auto budget = m_time_manager.allocate(
+			root, step, false, node->children().size());
+		update_loop(std::move(node), start_time, budget);
+		const auto best = best_move_snapshot();
 		return std::make_pair(best.p, best.q);
 	}
 
 	int select(
-		const State& root, int p, int q, int step, const std::vector<History>& history)
+		const State& root, int p, int q, int step, const std::vector<History>& history,
+		std::chrono::steady_clock::time_point received = std::chrono::steady_clock::now())
 	{
+		start_decision("select", step, received);
+		const auto start_time = std::chrono::steady_clock::now();
 		const int color = 1 - 2 * (step & 1);
-		auto node = std::make_unique<MCTSNode>(
-			nullptr, root, color, Move(p, q), true);
-		node->expand();
-		update_loop(*node);
-		const auto best = node->select_best_move();
-		return best.p;
+		auto node = create_root(root, color, Move(p, q), true);
+		const auto budget = m_time_manager.allocate(
+			root, step + 1, true, node->children().size());
+		update_loop(std::move(node), start_time, budget);
+		return best_move_snapshot().p;
 	}
 
 };
@@ -0,0 +1,364 @@
+#pragma once
+#include <array>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include "state.hpp"
+#include "quantum_features.hpp"
+
+// Policy/value network for PUCT. A position is seen by the player to
+// decide through NUM_PLANES planes of 36 cells:
+//
+//   0  own stones             4  cells of components of own stones only
+//   1  opponent stones        5  cells of components of opponent stones only
+//   2  cells of own quantum   6  cells whose color is still undecided
+//      stones                 7  the two cells of a cycle waiting for a
+//   3  cells of opponent         selection
+//      quantum stones
+//
+// The inputs are binary, so the first layer adds up the int16 columns of
+// the set inputs. Two clipped ReLU layers follow with uint8 activations
+// and int8 weights, and the output layer gives 36 placement logits, 36
+// selection logits and the value logit. A pair (p, q) has the prior
+// softmax of placement[p] + placement[q], a selected cell that of its
+// selection logit. All arithmetic is integer, so the AVX2 kernels (built
+// with -mavx2) and the portable ones give the same outputs.
+
+namespace network {
+
+static constexpr uint32_t NETWORK_MAGIC = 0x56505251u;  // "QRPV"
+static constexpr uint32_t NETWORK_VERSION = 1;
+
+static constexpr int NUM_PLANES = 8;
+static constexpr int NUM_INPUTS = NUM_PLANES * 36;
+static constexpr int HIDDEN1 = 128;
+static constexpr int HIDDEN2 = 64;
+static constexpr int PLACEMENT_OUTPUT = 0;
+static constexpr int SELECTION_OUTPUT = 36;
+static constexpr int VALUE_OUTPUT = 72;
+static constexpr int NUM_OUTPUTS = 73;
+// at most this many inputs are set: the stone planes and planes 4 to 6 are
+// disjoint within themselves
+static constexpr int MAX_ACTIVE = 36 + 36 + 36 + 36 + 2;
+// positions of one call of Network::evaluate_values()
+static constexpr int MAX_BATCH = 64;
+
+// Fixed-point scales: an activation of 1.0 is 127, so the first layer
+// weights are scaled by 127 and the others by WEIGHT_SCALE.
+static constexpr int ACTIVATION_SCALE = 127;
+static constexpr int WEIGHT_SHIFT = 6;
+static constexpr int WEIGHT_SCALE = 1 << WEIGHT_SHIFT;
+
+struct NetworkHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_inputs;
+	uint32_t hidden1;
+	uint32_t hidden2;
+	uint32_t num_outputs;
+	uint32_t reserved[2];
+};
+
+static_assert(sizeof(NetworkHeader) == 32, "unexpected NetworkHeader layout");
+
+// The quantized parameters, stored in this order after the header.
+// Weights of a layer are row-major by output, except the first layer whose
+// rows are inputs. Operator new of C++14 ignores over-alignment, so the
+// kernels use unaligned loads on them.
+struct Parameters {
+	int16_t l1_bias[HIDDEN1];
+	int16_t l1_weights[NUM_INPUTS][HIDDEN1];
+	int32_t l2_bias[HIDDEN2];
+	int8_t l2_weights[HIDDEN2][HIDDEN1];
+	int32_t out_bias[NUM_OUTPUTS];
+	int8_t out_weights[NUM_OUTPUTS][HIDDEN2];
+};
+
+// the same network in floating point, as trained
+struct FloatParameters {
+	float l1_bias[HIDDEN1];
+	float l1_weights[NUM_INPUTS][HIDDEN1];
+	float l2_bias[HIDDEN2];
+	float l2_weights[HIDDEN2][HIDDEN1];
+	float out_bias[NUM_OUTPUTS];
+	float out_weights[NUM_OUTPUTS][HIDDEN2];
+};
+
+struct Output {
+	float placement[36];   // logits
+	float selection[36];   // logits
+	float value;           // win probability of the player to decide
+};
+
+// Indices of the set inputs for the player `color` to decide; `pending` is
+// the mask of a cycle waiting for a selection. Returns their number.
+inline int active_inputs(const State& s, int color, uint64_t pending, uint16_t *out){
+	const QuantumFeatures features(s);
+	const auto& board = s.classic_board();
+	uint64_t own_edges = 0, opponent_edges = 0;
+	for(const auto& e : s.edges()){
+		const uint64_t cells = (1ul << e.u) | (1ul << e.v);
+		if(e.color == color){
+			own_edges |= cells;
+		}else{
+			opponent_edges |= cells;
+		}
+	}
+	const bool black = color > 0;
+	const uint64_t planes[NUM_PLANES] = {
+		board.bitmap(color),
+		board.bitmap(-color),
+		own_edges,
+		opponent_edges,
+		black ? features.black_only() : features.white_only(),
+		black ? features.white_only() : features.black_only(),
+		features.undecided(),
+		pending
+	};
+	int n = 0;
+	for(int i = 0; i < NUM_PLANES; ++i){
+		for(uint64_t b = planes[i]; b; b &= b - 1){
+			out[n++] = static_cast<uint16_t>(i * 36 + __builtin_ctzll(b));
+		}
+	}
+	return n;
+}
+
+namespace detail {
+
+inline int8_t quantize8(float x){
+	return static_cast<int8_t>(std::max(-127.0f, std::min(127.0f, std::round(x))));
+}
+
+inline int16_t quantize16(float x){
+	return static_cast<int16_t>(std::max(-32767.0f, std::min(32767.0f, std::round(x))));
+}
+
+inline int32_t quantize32(float x){
+	return static_cast<int32_t>(std::round(x));
+}
+
+inline uint8_t clip_activation(int x){
+	return static_cast<uint8_t>(std::max(0, std::min(ACTIVATION_SCALE, x)));
+}
+
+#ifdef __AVX2__
+inline int32_t horizontal_sum(__m256i x){
+	__m128i s = _mm_add_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+	return _mm_cvtsi128_si32(s);
+}
+
+// dot product of `n` uint8 activations and int8 weights, n % 32 == 0
+inline int32_t dot(const uint8_t *a, const int8_t *w, int n){
+	const __m256i ones = _mm256_set1_epi16(1);
+	__m256i sum = _mm256_setzero_si256();
+	for(int i = 0; i < n; i += 32){
+		const __m256i x = _mm256_load_si256(reinterpret_cast<const __m256i *>(a + i));
+		const __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(w + i));
+		// pairs of products stay below 2 * 127 * 127 and do not saturate
+		sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(x, y), ones));
+	}
+	return horizontal_sum(sum);
+}
+#else
+inline int32_t dot(const uint8_t *a, const int8_t *w, int n){
+	int32_t sum = 0;
+	for(int i = 0; i < n; ++i){ sum += a[i] * w[i]; }
+	return sum;
+}
+#endif
+
+}
+
+// writes `p` quantized; weights beyond the int8 range are clipped
+inline bool write_network(const char *path, const FloatParameters& p){
+	std::unique_ptr<Parameters> q(new Parameters());
+	const float s1 = ACTIVATION_SCALE;
+	const float s2 = static_cast<float>(ACTIVATION_SCALE) * WEIGHT_SCALE;
+	for(int j = 0; j < HIDDEN1; ++j){
+		q->l1_bias[j] = detail::quantize16(p.l1_bias[j] * s1);
+		for(int i = 0; i < NUM_INPUTS; ++i){
+			q->l1_weights[i][j] = detail::quantize16(p.l1_weights[i][j] * s1);
+		}
+	}
+	for(int j = 0; j < HIDDEN2; ++j){
+		q->l2_bias[j] = detail::quantize32(p.l2_bias[j] * s2);
+		for(int i = 0; i < HIDDEN1; ++i){
+			q->l2_weights[j][i] = detail::quantize8(p.l2_weights[j][i] * WEIGHT_SCALE);
+		}
+	}
+	for(int j = 0; j < NUM_OUTPUTS; ++j){
+		q->out_bias[j] = detail::quantize32(p.out_bias[j] * s2);
+		for(int i = 0; i < HIDDEN2; ++i){
+			q->out_weights[j][i] = detail::quantize8(p.out_weights[j][i] * WEIGHT_SCALE);
+		}
+	}
+	NetworkHeader header;
+	std::memset(&header, 0, sizeof(header));
+	header.magic = NETWORK_MAGIC;
+	header.version = NETWORK_VERSION;
+	header.num_inputs = NUM_INPUTS;
+	header.hidden1 = HIDDEN1;
+	header.hidden2 = HIDDEN2;
+	header.num_outputs = NUM_OUTPUTS;
+	FILE *fp = fopen(path, "wb");
+	if(!fp){ return false; }
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	ok = ok && fwrite(q->l1_bias, sizeof(q->l1_bias), 1, fp) == 1;
+	ok = ok && fwrite(q->l1_weights, sizeof(q->l1_weights), 1, fp) == 1;
+	ok = ok && fwrite(q->l2_bias, sizeof(q->l2_bias), 1, fp) == 1;
+	ok = ok && fwrite(q->l2_weights, sizeof(q->l2_weights), 1, fp) == 1;
+	ok = ok && fwrite(q->out_bias, sizeof(q->out_bias), 1, fp) == 1;
+	ok = ok && fwrite(q->out_weights, sizeof(q->out_weights), 1, fp) == 1;
+	return (fclose(fp) == 0) && ok;
+}
+
+// The quantized network, read into memory once; about 88 KB, so it stays
+// in L2 during a search. Evaluation is thread-safe.
+class Network {
+
+private:
+	std::unique_ptr<Parameters> m_parameters;
+
+	// clipped activations of the first layer
+	void first_layer(const uint16_t *active, int num_active, uint8_t *h1) const {
+		const Parameters& p = *m_parameters;
+#ifdef __AVX2__
+		static_assert(HIDDEN1 == 128, "the first layer is kept in 8 registers");
+		__m256i acc[8];
+		for(int k = 0; k < 8; ++k){
+			acc[k] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p.l1_bias) + k);
+		}
+		for(int i = 0; i < num_active; ++i){
+			const __m256i *column = reinterpret_cast<const __m256i *>(p.l1_weights[active[i]]);
+			for(int k = 0; k < 8; ++k){
+				acc[k] = _mm256_adds_epi16(acc[k], _mm256_loadu_si256(column + k));
+			}
+		}
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i limit = _mm256_set1_epi16(ACTIVATION_SCALE);
+		for(int k = 0; k < 8; k += 2){
+			const __m256i a = _mm256_min_epi16(_mm256_max_epi16(acc[k], zero), limit);
+			const __m256i b = _mm256_min_epi16(_mm256_max_epi16(acc[k + 1], zero), limit);
+			// packus interleaves the 128-bit lanes of a and b
+			const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xd8);
+			_mm256_store_si256(reinterpret_cast<__m256i *>(h1 + 16 * k), packed);
+		}
+#else
+		int acc[HIDDEN1];
+		for(int j = 0; j < HIDDEN1; ++j){ acc[j] = p.l1_bias[j]; }
+		for(int i = 0; i < num_active; ++i){
+			const int16_t *column = p.l1_weights[active[i]];
+			for(int j = 0; j < HIDDEN1; ++j){
+				// saturating like the 16-bit additions of AVX2
+				acc[j] = std::max(-32768, std::min(32767, acc[j] + column[j]));
+			}
+		}
+		for(int j = 0; j < HIDDEN1; ++j){ h1[j] = detail::clip_activation(acc[j]); }
+#endif
+	}
+
+public:
+	Network()
+		: m_parameters()
+	{ }
+
+	Network(const Network&) = delete;
+	Network& operator=(const Network&) = delete;
+
+	bool open(const char *path){
+		close();
+		FILE *fp = fopen(path, "rb");
+		if(!fp){ return false; }
+		std::unique_ptr<Parameters> p(new Parameters());
+		NetworkHeader header;
+		bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+			header.magic == NETWORK_MAGIC && header.version == NETWORK_VERSION &&
+			header.num_inputs == NUM_INPUTS && header.hidden1 == HIDDEN1 &&
+			header.hidden2 == HIDDEN2 && header.num_outputs == NUM_OUTPUTS;
+		ok = ok && fread(p->l1_bias, sizeof(p->l1_bias), 1, fp) == 1;
+		ok = ok && fread(p->l1_weights, sizeof(p->l1_weights), 1, fp) == 1;
+		ok = ok && fread(p->l2_bias, sizeof(p->l2_bias), 1, fp) == 1;
+		ok = ok && fread(p->l2_weights, sizeof(p->l2_weights), 1, fp) == 1;
+		ok = ok && fread(p->out_bias, sizeof(p->out_bias), 1, fp) == 1;
+		ok = ok && fread(p->out_weights, sizeof(p->out_weights), 1, fp) == 1;
+		// nothing may follow
+		ok = ok && fgetc(fp) == EOF;
+		fclose(fp);
+		if(!ok){ return false; }
+		m_parameters = std::move(p);
+		return true;
+	}
+
+	void close(){
+		m_parameters.reset();
+	}
+
+	bool is_open() const {
+		return m_parameters != nullptr;
+	}
+
+	// evaluates the position for the player `color` to decide; `pending` is
+	// the mask of a cycle waiting for a selection
+	void evaluate(const State& s, int color, uint64_t pending, Output& out) const {
+		uint16_t active[MAX_ACTIVE];
+		const int num_active = active_inputs(s, color, pending, active);
+		evaluate(active, num_active, out);
+	}
+
+	void evaluate(const uint16_t *active, int num_active, Output& out) const {
+		const Parameters& p = *m_parameters;
+		alignas(32) uint8_t h1[HIDDEN1];
+		alignas(32) uint8_t h2[HIDDEN2];
+		first_layer(active, num_active, h1);
+		for(int j = 0; j < HIDDEN2; ++j){
+			const int32_t sum = p.l2_bias[j] + detail::dot(h1, p.l2_weights[j], HIDDEN1);
+			h2[j] = detail::clip_activation(sum >> WEIGHT_SHIFT);
+		}
+		const float scale = 1.0f / (static_cast<float>(ACTIVATION_SCALE) * WEIGHT_SCALE);
+		float logits[NUM_OUTPUTS];
+		for(int j = 0; j < NUM_OUTPUTS; ++j){
+			logits[j] = (p.out_bias[j] + detail::dot(h2, p.out_weights[j], HIDDEN2)) * scale;
+		}
+		std::memcpy(out.placement, logits + PLACEMENT_OUTPUT, sizeof(out.placement));
+		std::memcpy(out.selection, logits + SELECTION_OUTPUT, sizeof(out.selection));
+		out.value = 1.0f / (1.0f + std::exp(-logits[VALUE_OUTPUT]));
+	}
+
+	// values of `n` <= MAX_BATCH positions given by their active inputs,
+	// without the policy outputs; the rows of the second layer are read
+	// once for the whole batch. Same values as evaluate().
+	void evaluate_values(
+		const uint16_t *const *active, const int *num_active, int n, float *values) const
+	{
+		const Parameters& p = *m_parameters;
+		alignas(32) uint8_t h1[MAX_BATCH][HIDDEN1];
+		alignas(32) uint8_t h2[MAX_BATCH][HIDDEN2];
+		for(int b = 0; b < n; ++b){ first_layer(active[b], num_active[b], h1[b]); }
+		for(int j = 0; j < HIDDEN2; ++j){
+			const int8_t *row = p.l2_weights[j];
+			for(int b = 0; b < n; ++b){
+				const int32_t sum = p.l2_bias[j] + detail::dot(h1[b], row, HIDDEN1);
+				h2[b][j] = detail::clip_activation(sum >> WEIGHT_SHIFT);
+			}
+		}
+		const float scale = 1.0f / (static_cast<float>(ACTIVATION_SCALE) * WEIGHT_SCALE);
+		for(int b = 0; b < n; ++b){
+			const float logit = (p.out_bias[VALUE_OUTPUT] +
+				detail::dot(h2[b], p.out_weights[VALUE_OUTPUT], HIDDEN2)) * scale;
+			values[b] = 1.0f / (1.0f + std::exp(-logit));
+		}
+	}
+
+};
+
+}
@@ -0,0 +1,387 @@
+// Trainer of the policy/value network over self-play records
+// g++ src/network_trainer.cpp -std=c++14 -O3 -march=native -pthread -o network_trainer
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <memory>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "state.hpp"
+#include "game_tracker.hpp"
+#include "game_record.hpp"
+#include "network.hpp"
+#include "training.hpp"
+
+struct TrainerOptions {
+	const char *output = "network.bin";
+	int num_epochs = 6;
+	int batch_size = 256;
+	double learning_rate = 0.001;
+	double value_mix = 0.5;          // share of the root value in the value target
+	double validation = 0.05;        // share of games held out
+	uint32_t seed = 1;
+	int num_threads = static_cast<int>(std::thread::hardware_concurrency());
+};
+
+// a searched decision with its targets
+struct TrainingPosition {
+	uint16_t active[network::MAX_ACTIVE];
+	uint8_t num_active;
+	uint8_t kind;               // PositionStats::Kind
+	uint8_t num_entries;
+	uint64_t empty;             // cells a placement may use
+	int8_t cycle[2];            // cells of the cycle of a selection
+	float value;                // target of the player to decide
+	float result;               // game result for the player to decide
+	VisitEntry entries[RECORD_NUM_ENTRIES];
+};
+
+static constexpr size_t NUM_PARAMETERS = sizeof(network::FloatParameters) / sizeof(float);
+static constexpr float MAX_WEIGHT = 127.0f / network::WEIGHT_SCALE;
+
+// all parameters as one array
+struct ParameterVector {
+	std::unique_ptr<network::FloatParameters> p;
+	ParameterVector() : p(new network::FloatParameters()) { clear(); }
+	float *data(){ return reinterpret_cast<float *>(p.get()); }
+	void clear(){ std::memset(p.get(), 0, sizeof(network::FloatParameters)); }
+};
+
+inline float sigmoid(float x){
+	return 1.0f / (1.0f + std::exp(-x));
+}
+
+inline float clip(float x){
+	return std::max(0.0f, std::min(1.0f, x));
+}
+
+class Trainer {
+
+private:
+	struct Loss {
+		double policy;          // cross entropy against the visit shares
+		double value;           // squared error against the game result
+		long long count;
+		Loss() : policy(0.0), value(0.0), count(0) { }
+		void add(const Loss& other){
+			policy += other.policy;
+			value += other.value;
+			count += other.count;
+		}
+	};
+
+	TrainerOptions m_options;
+	std::vector<TrainingPosition> m_positions;
+	size_t m_num_training;
+	ParameterVector m_weights;
+	training::Adam<float> m_optimizer;
+	std::vector<ParameterVector> m_gradients;   // one per thread
+
+	void add(const GameTracker& tracker, const PositionStats& stats, double result){
+		TrainingPosition pos;
+		std::memset(&pos, 0, sizeof(pos));
+		pos.kind = stats.kind;
+		uint64_t pending = 0;
+		int color = 1 - 2 * (tracker.step() & 1);
+		if(stats.kind == PositionStats::SELECTION){
+			// the move closing the cycle is already played; its opponent selects
+			const auto closer = tracker.pending_move();
+			pos.cycle[0] = static_cast<int8_t>(closer.first);
+			pos.cycle[1] = static_cast<int8_t>(closer.second);
+			pending = (1ul << closer.first) | (1ul << closer.second);
+			color = 2 * ((tracker.step() - 1) & 1) - 1;
+		}
+		const auto& board = tracker.state().classic_board();
+		pos.empty = ((1ul << 36) - 1ul) & ~(board.bitmap(1) | board.bitmap(-1));
+		pos.num_active = static_cast<uint8_t>(
+			network::active_inputs(tracker.state(), color, pending, pos.active));
+		pos.value = static_cast<float>(stats.value / 65535.0);
+		pos.result = static_cast<float>(color > 0 ? result : 1.0 - result);
+		pos.num_entries = stats.num_entries;
+		std::copy(stats.entries, stats.entries + stats.num_entries, pos.entries);
+		m_positions.push_back(pos);
+	}
+
+	// replays a game and extracts its searched decisions
+	void extract(const GameRecordView& game){
+		const double result = training::result_of(game);
+		training::replay(game, [this, result](
+			const GameTracker& tracker, const PositionStats& stats)
+		{
+			add(tracker, stats, result);
+		});
+	}
+
+	// forward and backward pass of one position; the gradient is added to
+	// `grad` unless it is null
+	void process(const TrainingPosition& pos, network::FloatParameters *grad, Loss& loss) const {
+		using namespace network;
+		const FloatParameters& w = *m_weights.p;
+		float z1[HIDDEN1], h1[HIDDEN1], z2[HIDDEN2], h2[HIDDEN2], out[NUM_OUTPUTS];
+		std::copy(w.l1_bias, w.l1_bias + HIDDEN1, z1);
+		for(int i = 0; i < pos.num_active; ++i){
+			const float *column = w.l1_weights[pos.active[i]];
+			for(int j = 0; j < HIDDEN1; ++j){ z1[j] += column[j]; }
+		}
+		for(int j = 0; j < HIDDEN1; ++j){ h1[j] = clip(z1[j]); }
+		for(int k = 0; k < HIDDEN2; ++k){
+			float sum = w.l2_bias[k];
+			for(int j = 0; j < HIDDEN1; ++j){ sum += w.l2_weights[k][j] * h1[j]; }
+			z2[k] = sum;
+			h2[k] = clip(sum);
+		}
+		// only the outputs of the decision are computed
+		float d_out[NUM_OUTPUTS];
+		std::fill(d_out, d_out + NUM_OUTPUTS, 0.0f);
+		auto output = [&](int m){
+			float sum = w.out_bias[m];
+			for(int k = 0; k < HIDDEN2; ++k){ sum += w.out_weights[m][k] * h2[k]; }
+			return out[m] = sum;
+		};
+		float visits = 0.0f;
+		for(int i = 0; i < pos.num_entries; ++i){ visits += pos.entries[i].visits; }
+		if(pos.kind == PositionStats::PLACEMENT){
+			// pairs (p, q) have weights e[p] * e[q], so the marginal of a cell
+			// c is e[c] r[c] / Z with r[c] the sum of the other weights and
+			// Z = sum e[c] r[c] / 2; r is summed from both ends, as S - e[c]
+			// cancels when one cell dominates
+			float e[36], rest[36], target[36];
+			float max_logit = -1e30f;
+			for(uint64_t b = pos.empty; b; b &= b - 1){
+				max_logit = std::max(max_logit, output(PLACEMENT_OUTPUT + __builtin_ctzll(b)));
+			}
+			for(int c = 0; c < 36; ++c){
+				e[c] = (pos.empty >> c) & 1 ? std::exp(out[PLACEMENT_OUTPUT + c] - max_logit) : 0.0f;
+				target[c] = 0.0f;
+			}
+			float prefix = 0.0f;
+			for(int c = 0; c < 36; ++c){
+				rest[c] = prefix;
+				prefix += e[c];
+			}
+			float suffix = 0.0f, z = 0.0f;
+			for(int c = 35; c >= 0; --c){
+				rest[c] += suffix;
+				suffix += e[c];
+				z += 0.5f * e[c] * rest[c];
+			}
+			for(int i = 0; i < pos.num_entries && visits > 0.0f; ++i){
+				const auto& entry = pos.entries[i];
+				const float t = entry.visits / visits;
+				target[entry.p] += t;
+				target[entry.q] += t;
+				loss.policy -= t * std::log(std::max(e[entry.p] * e[entry.q] / z, 1e-30f));
+			}
+			for(int c = 0; c < 36; ++c){
+				if((pos.empty >> c) & 1){
+					d_out[PLACEMENT_OUTPUT + c] = e[c] * rest[c] / z - target[c];
+				}
+			}
+		}else if(visits > 0.0f){
+			// a softmax over the two cells of the cycle
+			const int a = pos.cycle[0], b = pos.cycle[1];
+			const float pa = sigmoid(output(SELECTION_OUTPUT + a) - output(SELECTION_OUTPUT + b));
+			float ta = 0.0f;
+			for(int i = 0; i < pos.num_entries; ++i){
+				if(pos.entries[i].p == a){ ta += pos.entries[i].visits / visits; }
+			}
+			loss.policy -= ta * std::log(std::max(pa, 1e-30f)) +
+			               (1.0f - ta) * std::log(std::max(1.0f - pa, 1e-30f));
+			d_out[SELECTION_OUTPUT + a] = pa - ta;
+			d_out[SELECTION_OUTPUT + b] = ta - pa;
+		}
+		const float v = sigmoid(output(VALUE_OUTPUT));
+		const float mix = static_cast<float>(m_options.value_mix);
+		d_out[VALUE_OUTPUT] = v - ((1.0f - mix) * pos.result + mix * pos.value);
+		loss.value += (v - pos.result) * (v - pos.result);
+		++loss.count;
+		if(!grad){ return; }
+		float d_h2[HIDDEN2];
+		std::fill(d_h2, d_h2 + HIDDEN2, 0.0f);
+		for(int m = 0; m < NUM_OUTPUTS; ++m){
+			const float d = d_out[m];
+			if(d == 0.0f){ continue; }
+			grad->out_bias[m] += d;
+			for(int k = 0; k < HIDDEN2; ++k){
+				grad->out_weights[m][k] += d * h2[k];
+				d_h2[k] += d * w.out_weights[m][k];
+			}
+		}
+		float d_h1[HIDDEN1];
+		std::fill(d_h1, d_h1 + HIDDEN1, 0.0f);
+		for(int k = 0; k < HIDDEN2; ++k){
+			if(z2[k] <= 0.0f || z2[k] >= 1.0f){ continue; }
+			const float d = d_h2[k];
+			grad->l2_bias[k] += d;
+			for(int j = 0; j < HIDDEN1; ++j){
+				grad->l2_weights[k][j] += d * h1[j];
+				d_h1[j] += d * w.l2_weights[k][j];
+			}
+		}
+		for(int j = 0; j < HIDDEN1; ++j){
+			if(z1[j] <= 0.0f || z1[j] >= 1.0f){ d_h1[j] = 0.0f; }
+			grad->l1_bias[j] += d_h1[j];
+		}
+		for(int i = 0; i < pos.num_active; ++i){
+			float *column = grad->l1_weights[pos.active[i]];
+			for(int j = 0; j < HIDDEN1; ++j){ column[j] += d_h1[j]; }
+		}
+	}
+
+	// Adam over the summed gradients of the threads; the weights of the
+	// int8 layers are kept in their quantized range
+	void apply(int batch_size){
+		m_optimizer.step(m_weights.data(), [this, batch_size](size_t i){
+			float g = 0.0f;
+			for(auto& grad : m_gradients){ g += grad.data()[i]; }
+			return g / batch_size;
+		});
+		auto& p = *m_weights.p;
+		for(auto& row : p.l2_weights){
+			for(auto& x : row){ x = std::max(-MAX_WEIGHT, std::min(MAX_WEIGHT, x)); }
+		}
+		for(auto& row : p.out_weights){
+			for(auto& x : row){ x = std::max(-MAX_WEIGHT, std::min(MAX_WEIGHT, x)); }
+		}
+		for(auto& grad : m_gradients){ grad.clear(); }
+	}
+
+	void initialize(){
+		using namespace network;
+		std::mt19937 engine(m_options.seed);
+		auto fill = [&engine](float *x, size_t n, float limit){
+			std::uniform_real_distribution<float> dist(-limit, limit);
+			for(size_t i = 0; i < n; ++i){ x[i] = dist(engine); }
+		};
+		auto& p = *m_weights.p;
+		// about 60 inputs are set
+		fill(&p.l1_weights[0][0], NUM_INPUTS * HIDDEN1, 0.1f);
+		std::fill(p.l1_bias, p.l1_bias + HIDDEN1, 0.2f);
+		fill(&p.l2_weights[0][0], HIDDEN2 * HIDDEN1, std::sqrt(3.0f / HIDDEN1));
+		fill(&p.out_weights[0][0], NUM_OUTPUTS * HIDDEN2, std::sqrt(3.0f / HIDDEN2));
+	}
+
+public:
+	// the positions of the last games of the last files are held out for
+	// validation
+	Trainer(const TrainerOptions& options, const std::vector<std::unique_ptr<GameRecordFile>>& files)
+		: m_options(options)
+		, m_positions()
+		, m_num_training(0)
+		, m_weights()
+		, m_optimizer(NUM_PARAMETERS, options.learning_rate)
+		, m_gradients(std::max(1, options.num_threads))
+	{
+		training::split_games(files, options.validation, [this](
+			const GameRecordView& game, bool held_out)
+		{
+			extract(game);
+			if(!held_out){ m_num_training = m_positions.size(); }
+		});
+		initialize();
+	}
+
+	bool save(const char *path) const {
+		return network::write_network(path, *m_weights.p);
+	}
+
+	void run(){
+		std::cerr << std::fixed << std::setprecision(5);
+		std::cerr << m_num_training << " training positions, "
+		          << m_positions.size() - m_num_training << " validation positions" << std::endl;
+		std::mt19937 engine(m_options.seed);
+		const size_t batch_size = std::max(1, m_options.batch_size);
+		for(int epoch = 0; epoch < m_options.num_epochs; ++epoch){
+			const auto start = std::chrono::steady_clock::now();
+			std::shuffle(m_positions.begin(), m_positions.begin() + m_num_training, engine);
+			Loss train;
+			for(size_t begin = 0; begin < m_num_training; begin += batch_size){
+				const size_t end = std::min(begin + batch_size, m_num_training);
+				train.add(training::parallel_for<Loss>(
+					static_cast<int>(m_gradients.size()), begin, end, [this](int t, size_t i, Loss& loss)
+				{
+					process(m_positions[i], m_gradients[t].p.get(), loss);
+				}));
+				apply(static_cast<int>(end - begin));
+			}
+			const std::chrono::duration<double> elapsed =
+				std::chrono::steady_clock::now() - start;
+			const auto valid = training::parallel_for<Loss>(
+				static_cast<int>(m_gradients.size()), m_num_training, m_positions.size(), [this](
+					int, size_t i, Loss& loss)
+			{
+				process(m_positions[i], nullptr, loss);
+			});
+			const auto n = std::max<long long>(train.count, 1);
+			const auto m = std::max<long long>(valid.count, 1);
+			std::cerr << "epoch " << epoch << ": train policy " << train.policy / n
+			          << " value mse " << train.value / n
+			          << ", validation policy " << valid.policy / m
+			          << " value mse " << valid.value / m
+			          << " [" << train.count / elapsed.count() << " positions/s]" << std::endl;
+		}
+	}
+
+};
+
+static void usage(const char *name){
+	std::cerr << "Usage: " << name << " [options] records..." << std::endl;
+	std::cerr << "  -o path    : output network (default: network.bin)" << std::endl;
+	std::cerr << "  -e epochs  : passes over the training positions (default: 6)" << std::endl;
+	std::cerr << "  -b size    : positions per update (default: 256)" << std::endl;
+	std::cerr << "  -l rate    : learning rate of Adam (default: 0.001)" << std::endl;
+	std::cerr << "  -m mix     : share of the recorded root value in the value target (default: 0.5)" << std::endl;
+	std::cerr << "  -v share   : share of games held out for validation (default: 0.05)" << std::endl;
+	std::cerr << "  -s seed    : seed of the initial weights and the shuffles (default: 1)" << std::endl;
+	std::cerr << "  -j threads : number of worker threads (default: all cores)" << std::endl;
+}
+
+int main(int argc, char *argv[]){
+	TrainerOptions options;
+	std::vector<const char *> paths;
+	for(int i = 1; i < argc; ++i){
+		if(argv[i][0] != '-'){
+			paths.push_back(argv[i]);
+			continue;
+		}
+		if(i + 1 >= argc){ usage(argv[0]); return 1; }
+		if(strcmp(argv[i], "-o") == 0){
+			options.output = argv[++i];
+		}else if(strcmp(argv[i], "-e") == 0){
+			options.num_epochs = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "-b") == 0){
+			options.batch_size = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "-l") == 0){
+			options.learning_rate = atof(argv[++i]);
+		}else if(strcmp(argv[i], "-m") == 0){
+			options.value_mix = atof(argv[++i]);
+		}else if(strcmp(argv[i], "-v") == 0){
+			options.validation = atof(argv[++i]);
+		}else if(strcmp(argv[i], "-s") == 0){
+			options.seed = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+		}else if(strcmp(argv[i], "-j") == 0){
+			options.num_threads = atoi(argv[++i]);
+		}else{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(paths.empty()){
+		usage(argv[0]);
+		return 1;
+	}
+	std::vector<std::unique_ptr<GameRecordFile>> files;
+	if(!training::open_records(paths, files)){ return 1; }
+	Trainer trainer(options, files);
+	trainer.run();
+	if(!trainer.save(options.output)){
+		std::cerr << "failed to write " << options.output << std::endl;
+		return 1;
+	}
+	return 0;
+}
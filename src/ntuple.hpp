@@ -0,0 +1,334 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "state.hpp"
+#include "symmetry.hpp"
+#include "quantum_features.hpp"
+
+// Static evaluation by n-tuple patterns. Every pattern is a set of cells
+// read as a base-3 number (empty 0, black 1, white 2) and looked up in its
+// own weight table. It is applied under all 8 symmetries, and these share
+// the table; an image covering the same cells as another one is read in
+// its own digit order, so that the evaluation does not depend on the
+// orientation of the board. Linear terms over
+// the quantum features are added, and each game stage has its own set of
+// weights. The sum is a logit of the win probability of black.
+
+namespace ntuple {
+
+static constexpr uint32_t WEIGHTS_MAGIC = 0x544e5251u;  // "QRNT"
+static constexpr uint32_t WEIGHTS_VERSION = 3;
+static constexpr int NUM_STAGES = 4;
+static constexpr int MAX_PATTERN_CELLS = 9;
+
+struct Pattern {
+	const char *name;
+	int num_cells;
+	int cells[MAX_PATTERN_CELLS];
+};
+
+// cells are y * 6 + x
+static const Pattern PATTERNS[] = {
+	{ "edge_x",    8, {  0,  1,  2,  3,  4,  5,  7, 10 } },
+	{ "row_1",     6, {  6,  7,  8,  9, 10, 11 } },
+	{ "row_2",     6, { 12, 13, 14, 15, 16, 17 } },
+	{ "corner_3x3", 9, { 0,  1,  2,  6,  7,  8, 12, 13, 14 } },
+	{ "block_2x3", 6, { 13, 14, 15, 19, 20, 21 } },
+	{ "diagonal",  6, {  0,  7, 14, 21, 28, 35 } },
+};
+
+static constexpr int NUM_PATTERNS = sizeof(PATTERNS) / sizeof(PATTERNS[0]);
+static constexpr int MAX_INSTANCES = NUM_PATTERNS * NUM_SYMMETRIES;
+
+// linear terms after the pattern tables: a bias and the quantum features
+static constexpr int NUM_LINEAR = 1 + NUM_QUANTUM_FEATURES;
+
+inline int power_of_3(int n){
+	int x = 1;
+	for(int i = 0; i < n; ++i){ x *= 3; }
+	return x;
+}
+
+inline int stage_of(const State& s){
+	const auto& board = s.classic_board();
+	const int step = board.count(1) + board.count(-1) + static_cast<int>(s.edges().size());
+	return std::min(std::max(step - 4, 0) / 8, NUM_STAGES - 1);
+}
+
+// The lines a pattern is read from: 6 rows, 6 columns and the 2 long
+// diagonals, each as 6 bits. Bit k of line l is the cell line_cell(l, k).
+static constexpr int NUM_LINES = 14;
+static constexpr uint64_t DIAGONAL_MASK = 0x810204081ul;   // cells 0, 7, ..., 35
+// moves cell 7k to bit 58 + k; no two products of set bits overlap
+static constexpr uint64_t DIAGONAL_MAGIC = 0x0410410410400000ul;
+
+inline int line_cell(int line, int k){
+	if(line < 6){ return line * 6 + k; }
+	if(line < 12){ return k * 6 + (line - 6); }
+	return line == 12 ? k * 7 : k * 5 + 5;
+}
+
+inline void extract_lines(uint64_t x, uint8_t *out){
+	const uint64_t t = transpose(x);
+	for(int r = 0; r < 6; ++r){
+		out[r] = static_cast<uint8_t>((x >> (6 * r)) & 63);
+		out[6 + r] = static_cast<uint8_t>((t >> (6 * r)) & 63);
+	}
+	out[12] = static_cast<uint8_t>(((x & DIAGONAL_MASK) * DIAGONAL_MAGIC) >> 58);
+	out[13] = static_cast<uint8_t>(((flip_horizontal(x) & DIAGONAL_MASK) * DIAGONAL_MAGIC) >> 58);
+}
+
+// Tables turning the lines of a bitboard into pattern indices. An instance
+// is read from the fewest lines covering its cells, and every line adds a
+// precomputed partial index of its 6 bits.
+class Indexer {
+
+private:
+	struct Term {
+		uint8_t instance;
+		uint8_t line;
+		uint16_t table[64];   // 6 bits of black stones -> partial index
+	};
+
+	std::vector<Term> m_terms;
+	int m_num_instances;
+	uint32_t m_offsets[MAX_INSTANCES];      // first weight of its pattern
+	uint32_t m_pattern_offsets[NUM_PATTERNS + 1];
+
+	// the lines of one of the three families (rows, columns, diagonals)
+	// covering `image`; false if they do not
+	static bool cover(uint64_t image, int family, std::vector<int>& lines){
+		lines.clear();
+		const int first = family * 6, last = family < 2 ? first + 6 : NUM_LINES;
+		uint64_t covered = 0;
+		for(int l = first; l < last; ++l){
+			uint64_t mask = 0;
+			for(int k = 0; k < 6; ++k){ mask |= 1ul << line_cell(l, k); }
+			if(image & mask){
+				lines.push_back(l);
+				covered |= mask;
+			}
+		}
+		return (image & ~covered) == 0;
+	}
+
+public:
+	Indexer()
+		: m_terms()
+		, m_num_instances(0)
+	{
+		m_pattern_offsets[0] = 0;
+		for(int i = 0; i < NUM_PATTERNS; ++i){
+			m_pattern_offsets[i + 1] =
+				m_pattern_offsets[i] + power_of_3(PATTERNS[i].num_cells);
+		}
+		for(int i = 0; i < NUM_PATTERNS; ++i){
+			const auto& pattern = PATTERNS[i];
+			for(int t = 0; t < NUM_SYMMETRIES; ++t){
+				int cells[MAX_PATTERN_CELLS];
+				uint64_t image = 0;
+				for(int k = 0; k < pattern.num_cells; ++k){
+					cells[k] = transform_cell(pattern.cells[k], t);
+					image |= 1ul << cells[k];
+				}
+				const int instance = m_num_instances++;
+				m_offsets[instance] = m_pattern_offsets[i];
+				std::vector<int> lines, best;
+				for(int family = 0; family < 3; ++family){
+					if(cover(image, family, lines) && (best.empty() || lines.size() < best.size())){
+						best = lines;
+					}
+				}
+				// a cell in two chosen lines is counted by the first only
+				uint64_t done = 0;
+				for(const int l : best){
+					Term term;
+					term.instance = static_cast<uint8_t>(instance);
+					term.line = static_cast<uint8_t>(l);
+					for(int bits = 0; bits < 64; ++bits){
+						int index = 0;
+						for(int k = 0, w = 1; k < pattern.num_cells; ++k, w *= 3){
+							for(int x = 0; x < 6; ++x){
+								if(line_cell(l, x) == cells[k] && !(done & (1ul << cells[k])) &&
+								   (bits & (1 << x)))
+								{
+									index += w;
+								}
+							}
+						}
+						term.table[bits] = static_cast<uint16_t>(index);
+					}
+					for(int x = 0; x < 6; ++x){ done |= 1ul << line_cell(l, x); }
+					m_terms.push_back(term);
+				}
+			}
+		}
+	}
+
+	// number of weights of one stage
+	static int num_weights(){
+		int n = NUM_LINEAR;
+		for(const auto& pattern : PATTERNS){ n += power_of_3(pattern.num_cells); }
+		return n;
+	}
+
+	// index of the linear term `f` within a stage
+	static int linear_index(int f){
+		return num_weights() - NUM_LINEAR + f;
+	}
+
+	int num_instances() const {
+		return m_num_instances;
+	}
+
+	// weight indices of all instances within a stage; `out` has room for
+	// MAX_INSTANCES of them
+	void indices(const ClassicBoard& board, uint32_t *out) const {
+		uint8_t black[NUM_LINES], white[NUM_LINES];
+		extract_lines(board.bitmap(1), black);
+		extract_lines(board.bitmap(-1), white);
+		std::memcpy(out, m_offsets, sizeof(uint32_t) * m_num_instances);
+		for(const auto& term : m_terms){
+			out[term.instance] += term.table[black[term.line]] + 2 * term.table[white[term.line]];
+		}
+	}
+
+	// values of the linear terms
+	static void linear_features(const State& s, float *out){
+		out[0] = 1.0f;
+		QuantumFeatures(s).values(out + 1);
+	}
+
+};
+
+inline const Indexer& indexer(){
+	static const Indexer instance;
+	return instance;
+}
+
+struct WeightsHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_stages;
+	uint32_t num_weights;  // per stage
+};
+
+static_assert(sizeof(WeightsHeader) == 16, "unexpected WeightsHeader layout");
+
+// writes NUM_STAGES * Indexer::num_weights() weights, stage after stage
+inline bool write_weights(const char *path, const std::vector<float>& weights){
+	if(weights.size() != static_cast<size_t>(NUM_STAGES) * Indexer::num_weights()){
+		return false;
+	}
+	WeightsHeader header;
+	header.magic = WEIGHTS_MAGIC;
+	header.version = WEIGHTS_VERSION;
+	header.num_stages = NUM_STAGES;
+	header.num_weights = static_cast<uint32_t>(Indexer::num_weights());
+	FILE *fp = fopen(path, "wb");
+	if(!fp){ return false; }
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	ok = ok && fwrite(weights.data(), sizeof(float), weights.size(), fp) == weights.size();
+	return (fclose(fp) == 0) && ok;
+}
+
+// read-only view of a memory-mapped weight file
+class Evaluator {
+
+private:
+	void *m_address;
+	size_t m_length;
+	const float *m_weights;
+
+public:
+	Evaluator()
+		: m_address(nullptr)
+		, m_length(0)
+		, m_weights(nullptr)
+	{ }
+
+	Evaluator(const Evaluator&) = delete;
+	Evaluator& operator=(const Evaluator&) = delete;
+
+	~Evaluator(){
+		close();
+	}
+
+	bool open(const char *path){
+		close();
+		const int fd = ::open(path, O_RDONLY);
+		if(fd < 0){ return false; }
+		struct stat st;
+		if(fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(WeightsHeader))){
+			::close(fd);
+			return false;
+		}
+		void *address = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if(address == MAP_FAILED){ return false; }
+		const auto header = static_cast<const WeightsHeader *>(address);
+		const size_t expected = sizeof(WeightsHeader) +
+			sizeof(float) * static_cast<size_t>(NUM_STAGES) * Indexer::num_weights();
+		if(header->magic != WEIGHTS_MAGIC || header->version != WEIGHTS_VERSION ||
+		   header->num_stages != NUM_STAGES ||
+		   header->num_weights != static_cast<uint32_t>(Indexer::num_weights()) ||
+		   static_cast<size_t>(st.st_size) != expected)
+		{
+			munmap(address, st.st_size);
+			return false;
+		}
+		m_address = address;
+		m_length = st.st_size;
+		m_weights = reinterpret_cast<const float *>(header + 1);
+		return true;
+	}
+
+	void close(){
+		if(m_address){ munmap(m_address, m_length); }
+		m_address = nullptr;
+		m_length = 0;
+		m_weights = nullptr;
+	}
+
+	bool is_open() const {
+		return m_weights != nullptr;
+	}
+
+	// NUM_STAGES * Indexer::num_weights() weights, stage after stage
+	const float *weights() const {
+		return m_weights;
+	}
+
+	// logit of the win probability of black; zero without weights
+	float evaluate(const State& s) const {
+		if(!m_weights){ return 0.0f; }
+		const float *w = m_weights + static_cast<size_t>(stage_of(s)) * Indexer::num_weights();
+		const auto& ix = indexer();
+		uint32_t indices[MAX_INSTANCES];
+		ix.indices(s.classic_board(), indices);
+		float sum = 0.0f;
+		for(int i = 0; i < ix.num_instances(); ++i){ sum += w[indices[i]]; }
+		float linear[NUM_LINEAR];
+		Indexer::linear_features(s, linear);
+		const float *lw = w + Indexer::linear_index(0);
+		for(int i = 0; i < NUM_LINEAR; ++i){ sum += lw[i] * linear[i]; }
+		return sum;
+	}
+
+	// win probability of `color`
+	double win_probability(const State& s, int color) const {
+		const double x = evaluate(s) * color;
+		return 1.0 / (1.0 + std::exp(-x));
+	}
+
+};
+
+}
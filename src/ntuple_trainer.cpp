@@ -0,0 +1,305 @@
+// TD(lambda) trainer of the n-tuple evaluator over self-play records
+// g++ src/ntuple_trainer.cpp -std=c++14 -O3 -pthread -o ntuple_trainer
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "state.hpp"
+#include "game_tracker.hpp"
+#include "game_record.hpp"
+#include "ntuple.hpp"
+#include "training.hpp"
+
+struct TrainerOptions {
+	const char *output = "ntuple.bin";
+	const char *initial = nullptr;   // weights to start from
+	int num_epochs = 4;
+	double learning_rate = 0.002;
+	double lambda = 0.7;
+	double value_mix = 0.0;          // share of the root value in the targets
+	double validation = 0.05;        // share of games held out
+	int num_threads = static_cast<int>(std::thread::hardware_concurrency());
+};
+
+// the features of one position
+struct TrainingPosition {
+	int stage;
+	float root_value;     // of black, negative if the position was not searched
+	uint32_t indices[ntuple::MAX_INSTANCES];
+	float linear[ntuple::NUM_LINEAR];
+};
+
+// Weights shared by all threads. Updates are Hogwild: relaxed loads and
+// stores without locks, so concurrent updates of a weight may overwrite
+// each other. A position touches the 48 instances of its stage, at most 48
+// pattern weights of ~29000, and its 14 linear terms. Threads rarely meet
+// on a pattern weight. The linear terms are shared by every position of a
+// stage and do lose updates, but a lost update only drops one small step.
+// Instances of one position that share a weight are applied one after
+// another by its own thread, so they add up.
+class SharedWeights {
+
+private:
+	size_t m_size;
+	std::unique_ptr<std::atomic<float>[]> m_weights;
+
+public:
+	SharedWeights()
+		: m_size(static_cast<size_t>(ntuple::NUM_STAGES) * ntuple::Indexer::num_weights())
+		, m_weights(new std::atomic<float>[m_size])
+	{
+		for(size_t i = 0; i < m_size; ++i){ m_weights[i].store(0.0f, std::memory_order_relaxed); }
+	}
+
+	bool load(const char *path){
+		ntuple::Evaluator evaluator;
+		if(!evaluator.open(path)){ return false; }
+		const float *w = evaluator.weights();
+		for(size_t i = 0; i < m_size; ++i){ m_weights[i].store(w[i], std::memory_order_relaxed); }
+		return true;
+	}
+
+	bool save(const char *path) const {
+		std::vector<float> w(m_size);
+		for(size_t i = 0; i < m_size; ++i){ w[i] = m_weights[i].load(std::memory_order_relaxed); }
+		return ntuple::write_weights(path, w);
+	}
+
+	float evaluate(const TrainingPosition& pos, int num_instances) const {
+		const size_t base = static_cast<size_t>(pos.stage) * ntuple::Indexer::num_weights();
+		float sum = 0.0f;
+		for(int i = 0; i < num_instances; ++i){
+			sum += m_weights[base + pos.indices[i]].load(std::memory_order_relaxed);
+		}
+		const size_t linear = base + ntuple::Indexer::linear_index(0);
+		for(int i = 0; i < ntuple::NUM_LINEAR; ++i){
+			sum += m_weights[linear + i].load(std::memory_order_relaxed) * pos.linear[i];
+		}
+		return sum;
+	}
+
+	void update(const TrainingPosition& pos, int num_instances, float delta){
+		const size_t base = static_cast<size_t>(pos.stage) * ntuple::Indexer::num_weights();
+		for(int i = 0; i < num_instances; ++i){
+			auto& w = m_weights[base + pos.indices[i]];
+			w.store(w.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+		}
+		const size_t linear = base + ntuple::Indexer::linear_index(0);
+		for(int i = 0; i < ntuple::NUM_LINEAR; ++i){
+			auto& w = m_weights[linear + i];
+			w.store(w.load(std::memory_order_relaxed) + delta * pos.linear[i],
+			        std::memory_order_relaxed);
+		}
+	}
+
+};
+
+inline double sigmoid(double x){
+	return 1.0 / (1.0 + std::exp(-x));
+}
+
+class Trainer {
+
+private:
+	struct Loss {
+		double squared_error;   // of the prediction against the game result
+		long long count;
+		Loss() : squared_error(0.0), count(0) { }
+		void add(const Loss& other){
+			squared_error += other.squared_error;
+			count += other.count;
+		}
+	};
+
+	TrainerOptions m_options;
+	std::vector<GameRecordView> m_games;
+	SharedWeights m_weights;
+	int m_num_instances;
+	size_t m_num_training;
+
+	// replays a game and extracts every position waiting for a placement;
+	// positions waiting for a selection are skipped
+	void extract(const GameRecordView& game, std::vector<TrainingPosition>& out) const {
+		out.clear();
+		training::replay(game, [&out](const GameTracker& tracker, int){
+			const auto& state = tracker.state();
+			TrainingPosition pos;
+			pos.stage = ntuple::stage_of(state);
+			pos.root_value = -1.0f;
+			ntuple::indexer().indices(state.classic_board(), pos.indices);
+			ntuple::Indexer::linear_features(state, pos.linear);
+			out.push_back(pos);
+		}, [&out](const GameTracker& tracker, const PositionStats& stats){
+			if(stats.kind != PositionStats::PLACEMENT){ return; }
+			const double v = stats.value / 65535.0;
+			out.back().root_value = static_cast<float>((tracker.step() & 1) ? 1.0 - v : v);
+		});
+	}
+
+	// Offline TD(lambda): the lambda-returns are computed backwards from
+	// the result with the predictions before the update of the game.
+	void train_game(const GameRecordView& game, std::vector<TrainingPosition>& positions,
+	                std::vector<double>& predictions, Loss& loss)
+	{
+		extract(game, positions);
+		const double result = training::result_of(game);
+		const size_t n = positions.size();
+		predictions.resize(n);
+		for(size_t i = 0; i < n; ++i){
+			predictions[i] = sigmoid(m_weights.evaluate(positions[i], m_num_instances));
+		}
+		double target = result;
+		for(size_t i = n; i-- > 0; ){
+			if(i + 1 < n){
+				target = (1.0 - m_options.lambda) * predictions[i + 1] + m_options.lambda * target;
+			}
+			double t = target;
+			if(m_options.value_mix > 0.0 && positions[i].root_value >= 0.0f){
+				t = (1.0 - m_options.value_mix) * t + m_options.value_mix * positions[i].root_value;
+			}
+			// gradient of the cross entropy with respect to the logit
+			const double error = t - predictions[i];
+			m_weights.update(
+				positions[i], m_num_instances,
+				static_cast<float>(m_options.learning_rate * error));
+			const double d = result - predictions[i];
+			loss.squared_error += d * d;
+			++loss.count;
+		}
+	}
+
+	void validate_game(const GameRecordView& game, std::vector<TrainingPosition>& positions,
+	                   Loss& loss) const
+	{
+		extract(game, positions);
+		const double result = training::result_of(game);
+		for(const auto& pos : positions){
+			const double d = result - sigmoid(m_weights.evaluate(pos, m_num_instances));
+			loss.squared_error += d * d;
+			++loss.count;
+		}
+	}
+
+public:
+	// the last games of the last files are held out for validation
+	Trainer(const TrainerOptions& options, const std::vector<std::unique_ptr<GameRecordFile>>& files)
+		: m_options(options)
+		, m_games()
+		, m_weights()
+		, m_num_instances(ntuple::indexer().num_instances())
+		, m_num_training(0)
+	{
+		training::split_games(files, options.validation, [this](
+			const GameRecordView& game, bool held_out)
+		{
+			m_games.push_back(game);
+			if(!held_out){ ++m_num_training; }
+		});
+	}
+
+	bool load(const char *path){
+		return m_weights.load(path);
+	}
+
+	bool save(const char *path) const {
+		return m_weights.save(path);
+	}
+
+	void run(){
+		std::cerr << std::fixed << std::setprecision(5);
+		std::cerr << m_num_training << " training games, "
+		          << m_games.size() - m_num_training << " validation games" << std::endl;
+		for(int epoch = 0; epoch < m_options.num_epochs; ++epoch){
+			const auto start = std::chrono::steady_clock::now();
+			const auto train = training::parallel_for<Loss>(
+				m_options.num_threads, 0, m_num_training, [this](int, size_t i, Loss& loss)
+			{
+				thread_local std::vector<TrainingPosition> positions;
+				thread_local std::vector<double> predictions;
+				train_game(m_games[i], positions, predictions, loss);
+			});
+			const std::chrono::duration<double> elapsed =
+				std::chrono::steady_clock::now() - start;
+			const auto valid = training::parallel_for<Loss>(
+				m_options.num_threads, m_num_training, m_games.size(), [this](int, size_t i, Loss& loss)
+			{
+				thread_local std::vector<TrainingPosition> positions;
+				validate_game(m_games[i], positions, loss);
+			});
+			std::cerr << "epoch " << epoch << ": train mse "
+			          << train.squared_error / std::max<long long>(train.count, 1)
+			          << ", validation mse "
+			          << valid.squared_error / std::max<long long>(valid.count, 1)
+			          << " [" << train.count << " positions, "
+			          << train.count / elapsed.count() << " positions/s]" << std::endl;
+		}
+	}
+
+};
+
+static void usage(const char *name){
+	std::cerr << "Usage: " << name << " [options] records..." << std::endl;
+	std::cerr << "  -o path    : output weights (default: ntuple.bin)" << std::endl;
+	std::cerr << "  -i path    : initial weights (default: zeros)" << std::endl;
+	std::cerr << "  -e epochs  : passes over the training games (default: 4)" << std::endl;
+	std::cerr << "  -l rate    : learning rate (default: 0.002)" << std::endl;
+	std::cerr << "  -L lambda  : lambda of TD(lambda), 1 for the game result (default: 0.7)" << std::endl;
+	std::cerr << "  -m mix     : share of the recorded root value in the targets (default: 0)" << std::endl;
+	std::cerr << "  -v share   : share of games held out for validation (default: 0.05)" << std::endl;
+	std::cerr << "  -j threads : number of worker threads (default: all cores)" << std::endl;
+}
+
+int main(int argc, char *argv[]){
+	TrainerOptions options;
+	std::vector<const char *> paths;
+	for(int i = 1; i < argc; ++i){
+		if(argv[i][0] != '-'){
+			paths.push_back(argv[i]);
+			continue;
+		}
+		if(i + 1 >= argc){ usage(argv[0]); return 1; }
+		if(strcmp(argv[i], "-o") == 0){
+			options.output = argv[++i];
+		}else if(strcmp(argv[i], "-i") == 0){
+			options.initial = argv[++i];
+		}else if(strcmp(argv[i], "-e") == 0){
+			options.num_epochs = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "-l") == 0){
+			options.learning_rate = atof(argv[++i]);
+		}else if(strcmp(argv[i], "-L") == 0){
+			options.lambda = atof(argv[++i]);
+		}else if(strcmp(argv[i], "-m") == 0){
+			options.value_mix = atof(argv[++i]);
+		}else if(strcmp(argv[i], "-v") == 0){
+			options.validation = atof(argv[++i]);
+		}else if(strcmp(argv[i], "-j") == 0){
+			options.num_threads = atoi(argv[++i]);
+		}else{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(paths.empty()){
+		usage(argv[0]);
+		return 1;
+	}
+	std::vector<std::unique_ptr<GameRecordFile>> files;
+	if(!training::open_records(paths, files)){ return 1; }
+	Trainer trainer(options, files);
+	if(options.initial && !trainer.load(options.initial)){
+		std::cerr << "failed to load " << options.initial << std::endl;
+		return 1;
+	}
+	trainer.run();
+	if(!trainer.save(options.output)){
+		std::cerr << "failed to write " << options.output << std::endl;
+		return 1;
+	}
+	return 0;
+}
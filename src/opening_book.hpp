@@ -0,0 +1,193 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "state.hpp"
+#include "hash.hpp"
+#include "symmetry.hpp"
+
+static constexpr uint32_t BOOK_MAGIC = 0x4b425251u;  // "QRBK"
+static constexpr uint32_t BOOK_VERSION = 2;
+
+struct BookHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_slots;    // power of two
+	uint32_t num_entries;
+};
+
+struct BookEntry {
+	uint64_t hash;         // zero for empty slots
+	uint8_t p, q;          // in the frame of the canonical position
+	uint16_t win_rate;     // of the move, scaled to [0, 65535]
+	uint32_t num_playouts;
+};
+
+static_assert(sizeof(BookHeader) == 16, "unexpected BookHeader layout");
+static_assert(sizeof(BookEntry) == 16, "unexpected BookEntry layout");
+
+// the slot key of a position, shared by all of its symmetric variants;
+// zero is reserved for empty slots
+inline uint64_t book_key(const State& s){
+	const uint64_t h = canonical_hash(s);
+	return h ? h : 1;
+}
+
+// read-only view of a memory-mapped book
+class OpeningBook {
+
+private:
+	void *m_address;
+	size_t m_length;
+	const BookHeader *m_header;
+	const BookEntry *m_slots;
+
+public:
+	OpeningBook()
+		: m_address(nullptr)
+		, m_length(0)
+		, m_header(nullptr)
+		, m_slots(nullptr)
+	{ }
+
+	OpeningBook(const OpeningBook&) = delete;
+	OpeningBook& operator=(const OpeningBook&) = delete;
+
+	~OpeningBook(){
+		close();
+	}
+
+	bool open(const char *path){
+		close();
+		const int fd = ::open(path, O_RDONLY);
+		if(fd < 0){ return false; }
+		struct stat st;
+		if(fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(BookHeader))){
+			::close(fd);
+			return false;
+		}
+		void *address = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if(address == MAP_FAILED){ return false; }
+		const auto header = static_cast<const BookHeader *>(address);
+		const size_t expected =
+			sizeof(BookHeader) + sizeof(BookEntry) * static_cast<size_t>(header->num_slots);
+		if(header->magic != BOOK_MAGIC || header->version != BOOK_VERSION ||
+		   header->num_slots == 0 || (header->num_slots & (header->num_slots - 1)) ||
+		   header->num_entries >= header->num_slots ||
+		   static_cast<size_t>(st.st_size) != expected)
+		{
+			munmap(address, st.st_size);
+			return false;
+		}
+		m_address = address;
+		m_length = st.st_size;
+		m_header = header;
+		m_slots = reinterpret_cast<const BookEntry *>(header + 1);
+		return true;
+	}
+
+	void close(){
+		if(m_address){ munmap(m_address, m_length); }
+		m_address = nullptr;
+		m_length = 0;
+		m_header = nullptr;
+		m_slots = nullptr;
+	}
+
+	bool is_open() const {
+		return m_header != nullptr;
+	}
+
+	size_t size() const {
+		return m_header ? m_header->num_entries : 0;
+	}
+
+	// probes at most every slot once, so a table without empty slots (which
+	// open() rejects unless num_entries is wrong) can not hang it
+	const BookEntry *find(uint64_t key) const {
+		if(!m_header){ return nullptr; }
+		const uint32_t mask = m_header->num_slots - 1;
+		uint32_t i = key & mask;
+		for(uint32_t n = 0; n < m_header->num_slots; ++n, i = (i + 1) & mask){
+			const auto& entry = m_slots[i];
+			if(entry.hash == key){ return &entry; }
+			if(entry.hash == 0){ return nullptr; }
+		}
+		return nullptr;
+	}
+
+	// the book move of `s` mapped back from the canonical frame
+	const BookEntry *find(const State& s, int& p, int& q) const {
+		if(!m_header){ return nullptr; }
+		const int t = canonical_transform(s);
+		const auto entry = find(book_key(s));
+		if(!entry || entry->p >= 36 || entry->q >= 36){ return nullptr; }
+		const int u = inverse_transform_cell(entry->p, t);
+		const int v = inverse_transform_cell(entry->q, t);
+		p = std::min(u, v);
+		q = std::max(u, v);
+		return entry;
+	}
+
+};
+
+// builds an open-addressing table and writes it out
+class OpeningBookWriter {
+
+private:
+	std::vector<BookEntry> m_entries;
+
+public:
+	OpeningBookWriter()
+		: m_entries()
+	{ }
+
+	void add(const State& s, int p, int q, double win_rate, int num_playouts){
+		const int t = canonical_transform(s);
+		BookEntry entry;
+		entry.hash = book_key(s);
+		entry.p = static_cast<uint8_t>(transform_cell(p, t));
+		entry.q = static_cast<uint8_t>(transform_cell(q, t));
+		entry.win_rate = static_cast<uint16_t>(win_rate * 65535.0 + 0.5);
+		entry.num_playouts = static_cast<uint32_t>(num_playouts);
+		m_entries.push_back(entry);
+	}
+
+	size_t size() const {
+		return m_entries.size();
+	}
+
+	bool write(const char *path) const {
+		uint32_t num_slots = 1;
+		while(num_slots < 2 * m_entries.size()){ num_slots *= 2; }
+		std::vector<BookEntry> slots(num_slots);
+		std::memset(slots.data(), 0, sizeof(BookEntry) * num_slots);
+		size_t num_entries = 0;
+		for(const auto& entry : m_entries){
+			uint32_t i = entry.hash & (num_slots - 1);
+			while(slots[i].hash != 0 && slots[i].hash != entry.hash){
+				i = (i + 1) & (num_slots - 1);
+			}
+			if(slots[i].hash == 0){ ++num_entries; }
+			slots[i] = entry;
+		}
+		BookHeader header;
+		header.magic = BOOK_MAGIC;
+		header.version = BOOK_VERSION;
+		header.num_slots = num_slots;
+		header.num_entries = static_cast<uint32_t>(num_entries);
+		FILE *fp = fopen(path, "wb");
+		if(!fp){ return false; }
+		bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+		ok = ok && fwrite(slots.data(), sizeof(BookEntry), num_slots, fp) == num_slots;
+		return (fclose(fp) == 0) && ok;
+	}
+
+};
@@ -0,0 +1,385 @@
+// Game tree node counter for rules testing and move generation throughput
+// g++ src/perft.cpp -std=c++14 -O3 -pthread -o perft
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include "state.hpp"
+#include "hash.hpp"
+#include "game_tracker.hpp"
+
+// A position of the game tree. Selections are plies of their own: after a
+// move closing a cycle the position keeps the state before that move and
+// records the move as pending.
+struct PerftNode {
+	State state;
+	int pending_p;      // -1 when no selection is awaited
+	int pending_q;
+	int pending_color;  // color of the player who closed the cycle
+
+	PerftNode()
+		: state()
+		, pending_p(-1)
+		, pending_q(-1)
+		, pending_color(0)
+	{ }
+
+	int step() const {
+		const auto& board = state.classic_board();
+		return board.count(1) + board.count(-1) + static_cast<int>(state.edges().size()) +
+		       (pending_p >= 0 ? 1 : 0);
+	}
+
+	uint64_t hash() const {
+		return mix64(hash_state(state) ^ (static_cast<uint64_t>(pending_p + 1) << 48) ^
+		             (static_cast<uint64_t>(pending_q + 1) << 56));
+	}
+
+	// children in a fixed order
+	template <typename Func>
+	void for_each_child(Func func) const {
+		if(pending_p >= 0){
+			PerftNode child;
+			child.state = state;
+			child.state.select_entanglement(pending_p, pending_color);
+			func(child);
+			if(pending_q != pending_p){
+				child.state = state;
+				child.state.select_entanglement(pending_q, pending_color);
+				func(child);
+			}
+			return;
+		}
+		const auto& board = state.classic_board();
+		const uint64_t unused =
+			((1ul << 36) - 1ul) & ~(board.bitmap(1) | board.bitmap(-1));
+		const int color = 1 - 2 * (step() & 1);
+		std::array<int, 36> plist;
+		int pcount = 0;
+		for(uint64_t b = unused; b > 0; b &= b - 1){ plist[pcount++] = __builtin_ctzll(b); }
+		if(pcount == 1){
+			// the last cell closes a cycle by itself
+			PerftNode child;
+			child.state = state;
+			child.pending_p = child.pending_q = plist[0];
+			child.pending_color = color;
+			func(child);
+			return;
+		}
+		for(int i = 0; i < pcount; ++i){
+			for(int j = i + 1; j < pcount; ++j){
+				PerftNode child;
+				child.state = state;
+				if(state.test_entanglement(plist[i], plist[j])){
+					child.pending_p = plist[i];
+					child.pending_q = plist[j];
+					child.pending_color = color;
+				}else{
+					child.state.put(plist[i], plist[j], color);
+				}
+				func(child);
+			}
+		}
+	}
+
+	// number of children, without generating them
+	uint64_t count_children() const {
+		if(pending_p >= 0){ return pending_q != pending_p ? 2 : 1; }
+		const auto& board = state.classic_board();
+		const uint64_t n = 36 - board.count(1) - board.count(-1);
+		return n == 1 ? 1 : n * (n - 1) / 2;
+	}
+};
+
+// Per-thread transposition table of (position, depth) -> count. Entries are
+// replaced unconditionally; the 64-bit key is trusted.
+class PerftTable {
+
+private:
+	struct Entry {
+		uint64_t key;
+		uint64_t count;
+	};
+	std::vector<Entry> m_entries;
+
+	static uint64_t make_key(uint64_t hash, int depth){
+		return mix64(hash + static_cast<uint64_t>(depth)) | 1u;
+	}
+
+public:
+	explicit PerftTable(size_t num_entries)
+		: m_entries(num_entries, Entry{ 0, 0 })
+	{ }
+
+	bool enabled() const { return !m_entries.empty(); }
+
+	bool find(uint64_t hash, int depth, uint64_t& count) const {
+		const auto key = make_key(hash, depth);
+		const auto& e = m_entries[key & (m_entries.size() - 1)];
+		if(e.key != key){ return false; }
+		count = e.count;
+		return true;
+	}
+
+	void store(uint64_t hash, int depth, uint64_t count){
+		const auto key = make_key(hash, depth);
+		m_entries[key & (m_entries.size() - 1)] = Entry{ key, count };
+	}
+
+};
+
+static uint64_t perft(const PerftNode& node, int depth, PerftTable& table){
+	if(depth == 0){ return 1; }
+	if(depth == 1){ return node.count_children(); }
+	uint64_t hash = 0, count = 0;
+	if(table.enabled()){
+		hash = node.hash();
+		if(table.find(hash, depth, count)){ return count; }
+	}
+	node.for_each_child([&](const PerftNode& child){
+		count += perft(child, depth - 1, table);
+	});
+	if(table.enabled()){ table.store(hash, depth, count); }
+	return count;
+}
+
+// Sum over the leaves of a hash of their classic stones. The node count
+// does not depend on which stones were flipped; this does.
+static uint64_t perft_checksum(const PerftNode& node, int depth){
+	if(depth == 0){
+		const auto& board = node.state.classic_board();
+		return mix64(board.bitmap(1)) ^ mix64(board.bitmap(-1) ^ 0x9e3779b97f4a7c15ul);
+	}
+	uint64_t sum = 0;
+	node.for_each_child([&](const PerftNode& child){
+		sum += perft_checksum(child, depth - 1);
+	});
+	return sum;
+}
+
+struct PerftOptions {
+	int depth = 4;
+	int num_threads = static_cast<int>(std::thread::hardware_concurrency());
+	int hash_bits = 0;          // log2 of the table entries per thread, 0 disables
+	bool divide = false;        // print the count below every root child
+	bool check = false;         // compare with the known counts
+	bool checksum = false;      // also compute the leaf checksum
+	const char *moves = "";     // position as "p,q" moves and "c" selections
+};
+
+// Reference counts by depth for positions given by their moves. The counts
+// that the Python referee can reach in reasonable time were reproduced with
+// the rules of quantum_reversi.py: depth 2 of the initial position, depth 3
+// of the middle game and every depth of the endgame, and so were the leaf
+// checksums given here.
+struct KnownCounts {
+	const char *moves;
+	std::vector<uint64_t> counts;
+	std::vector<uint64_t> checksums;   // by depth, may be shorter
+};
+
+static const KnownCounts KNOWN_COUNTS[] = {
+	{ "", { 1ull, 496ull, 246016ull, 121778912ull, 60145004640ull },
+	  { 0x940fbafcf001dfbbull, 0xde7a4a1103a17a50ull, 0x0cef80f708dcfb00ull } },
+	{ "9,24 3,29 4,6 3,27 2,13 5,31 4,30 5,17 3,31 7,16 3,29 3 1,9 6,24 11,18 6,24 6 "
+	  "18,34 11,33 8,34",
+	  { 1ull, 190ull, 33844ull, 5907752ull, 1005319740ull },
+	  { 0x2922e01736a82f9bull, 0x87e2513a90d3550aull, 0x12e45602fc477d30ull,
+	    0xd345dc5be6127f16ull } },
+	{ "9,24 3,29 4,6 3,27 2,13 5,31 4,30 5,17 3,31 7,16 3,29 3 1,9 6,24 11,18 6,24 6 "
+	  "18,34 11,33 8,34 12,34 8,22 7,33 2,34 12,35 28,33 19,25 26,34 22,26 26 10,32",
+	  { 1ull, 15ull, 199ull, 2182ull, 15764ull, 30544ull, 7312ull, 384ull, 0ull },
+	  { 0xbfaf2aa200d6e816ull, 0x3b437f7e0c97994aull, 0xfbaf4f8bc147ac4full,
+	    0xbd005dfd14d3c7d7ull, 0x63cbe764d7f7dcc1ull, 0xaa2088fefe50fb53ull,
+	    0x801d4c546f3bfa3bull, 0xe1cbebe2d9f9f3ebull, 0x0ull } },
+};
+
+// Placements flipping in all eight directions at once: black plays at
+// (x, y) for x, y in {2, 3} with white stones on the eight neighbors and
+// black stones two cells away, and all eight white stones must turn. This
+// pins the flips towards lower rows, which the column mask once missed.
+static bool check_flips(){
+	bool ok = true;
+	for(int y = 2; y <= 3; ++y){
+		for(int x = 2; x <= 3; ++x){
+			ClassicBoard board;
+			uint64_t expected = 1ul << (y * 6 + x);
+			for(int dy = -1; dy <= 1; ++dy){
+				for(int dx = -1; dx <= 1; ++dx){
+					if(dx == 0 && dy == 0){ continue; }
+					const int near = (y + dy) * 6 + (x + dx);
+					const int far = (y + 2 * dy) * 6 + (x + 2 * dx);
+					board.force_put(near, -1);
+					board.force_put(far, 1);
+					expected |= (1ul << near) | (1ul << far);
+				}
+			}
+			board.put(y * 6 + x, 1);
+			const bool match = board.bitmap(1) == expected && board.bitmap(-1) == 0;
+			std::cout << "flips around " << y * 6 + x << (match ? " ok" : " MISMATCH") << std::endl;
+			ok = ok && match;
+		}
+	}
+	return ok;
+}
+
+static bool build_root(const char *moves, PerftNode& root){
+	GameTracker tracker;
+	// "p,q" is a move and a lone "c" a selection
+	std::istringstream words(moves);
+	std::string token;
+	while(words >> token){
+		const auto comma = token.find(',');
+		if(comma == std::string::npos){
+			if(!tracker.select(atoi(token.c_str()))){ return false; }
+		}else{
+			const int p = atoi(token.substr(0, comma).c_str());
+			const int q = atoi(token.substr(comma + 1).c_str());
+			if(p < 0 || p >= 36 || q < 0 || q >= 36 || !tracker.play(p, q)){ return false; }
+		}
+	}
+	root = PerftNode();
+	root.state = tracker.state();
+	if(tracker.has_pending()){
+		const auto pending = tracker.pending_move();
+		root.pending_p = pending.first;
+		root.pending_q = pending.second;
+		root.pending_color = 1 - 2 * ((tracker.step() - 1) & 1);
+	}
+	return true;
+}
+
+// splits the work at the root children
+static uint64_t parallel_perft(
+	const PerftNode& root, int depth, const PerftOptions& options, uint64_t *checksum = nullptr)
+{
+	if(depth == 0){
+		if(checksum){ *checksum = perft_checksum(root, 0); }
+		return 1;
+	}
+	if(depth == 1 && !checksum){ return root.count_children(); }
+	std::vector<PerftNode> children;
+	root.for_each_child([&](const PerftNode& child){ children.push_back(child); });
+	std::vector<uint64_t> counts(children.size(), 0);
+	std::vector<uint64_t> checksums(children.size(), 0);
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> threads;
+	for(int t = 0; t < std::max(1, options.num_threads); ++t){
+		threads.emplace_back([&]{
+			PerftTable table(options.hash_bits > 0 ? (static_cast<size_t>(1) << options.hash_bits) : 0);
+			while(true){
+				const size_t i = next++;
+				if(i >= children.size()){ break; }
+				counts[i] = perft(children[i], depth - 1, table);
+				if(checksum){ checksums[i] = perft_checksum(children[i], depth - 1); }
+			}
+		});
+	}
+	for(auto& t : threads){ t.join(); }
+	uint64_t total = 0;
+	if(checksum){ *checksum = 0; }
+	for(size_t i = 0; i < children.size(); ++i){
+		if(checksum){ *checksum += checksums[i]; }
+		if(options.divide){
+			const auto& c = children[i];
+			std::cout << "  ";
+			if(root.pending_p >= 0){
+				std::cout << (i == 0 ? root.pending_p : root.pending_q);
+			}else if(c.pending_p >= 0){
+				std::cout << c.pending_p << "," << c.pending_q;
+			}else{
+				const auto& e = c.state.edges()[c.state.edges().size() - 1];
+				std::cout << static_cast<int>(e.u) << "," << static_cast<int>(e.v);
+			}
+			std::cout << ": " << counts[i] << std::endl;
+		}
+		total += counts[i];
+	}
+	return total;
+}
+
+static void usage(const char *name){
+	std::cerr << "Usage: " << name << " [options]" << std::endl;
+	std::cerr << "  -d depth   : depth in plies, selections included (default: 4)" << std::endl;
+	std::cerr << "  -m moves   : position as \"p,q\" moves and \"c\" selections after the" << std::endl;
+	std::cerr << "               initial stones, e.g. \"8,27 9,22 8,27 27\" (default: initial)" << std::endl;
+	std::cerr << "  -j threads : number of threads (default: all cores)" << std::endl;
+	std::cerr << "  -H bits    : transposition table of 2^bits entries per thread (default: off)" << std::endl;
+	std::cerr << "  -D         : print the count below every root child" << std::endl;
+	std::cerr << "  -c         : check the flips and every depth up to -d against the known" << std::endl;
+	std::cerr << "               counts" << std::endl;
+	std::cerr << "  -x         : also compute a checksum of the classic stones of the leaves" << std::endl;
+}
+
+int main(int argc, char *argv[]){
+	PerftOptions options;
+	for(int i = 1; i < argc; ++i){
+		if(strcmp(argv[i], "-D") == 0){
+			options.divide = true;
+		}else if(strcmp(argv[i], "-c") == 0){
+			options.check = true;
+		}else if(strcmp(argv[i], "-x") == 0){
+			options.checksum = true;
+		}else{
+			if(i + 1 >= argc){ usage(argv[0]); return 1; }
+			if(strcmp(argv[i], "-d") == 0){
+				options.depth = atoi(argv[++i]);
+			}else if(strcmp(argv[i], "-m") == 0){
+				options.moves = argv[++i];
+			}else if(strcmp(argv[i], "-j") == 0){
+				options.num_threads = atoi(argv[++i]);
+			}else if(strcmp(argv[i], "-H") == 0){
+				options.hash_bits = atoi(argv[++i]);
+			}else{
+				usage(argv[0]);
+				return 1;
+			}
+		}
+	}
+
+	if(options.check){
+		bool ok = check_flips();
+		for(const auto& known : KNOWN_COUNTS){
+			PerftNode root;
+			build_root(known.moves, root);
+			for(int d = 0; d < static_cast<int>(known.counts.size()) && d <= options.depth; ++d){
+				PerftOptions o = options;
+				o.divide = false;
+				const bool has_checksum = d < static_cast<int>(known.checksums.size());
+				uint64_t checksum = 0;
+				const auto count = parallel_perft(root, d, o, has_checksum ? &checksum : nullptr);
+				bool match = (count == known.counts[d]);
+				std::cout << "\"" << known.moves << "\" depth " << d << ": " << count;
+				if(has_checksum){
+					match = match && (checksum == known.checksums[d]);
+					std::cout << ", checksum " << std::hex << checksum << std::dec;
+				}
+				std::cout << (match ? " ok" : " MISMATCH") << std::endl;
+				ok = ok && match;
+			}
+		}
+		return ok ? 0 : 1;
+	}
+
+	PerftNode root;
+	if(!build_root(options.moves, root)){
+		std::cerr << "invalid moves: " << options.moves << std::endl;
+		return 1;
+	}
+	const auto start = std::chrono::steady_clock::now();
+	uint64_t checksum = 0;
+	const auto count = parallel_perft(
+		root, options.depth, options, options.checksum ? &checksum : nullptr);
+	const double elapsed =
+		std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "depth " << options.depth << ": " << count << " nodes, " << elapsed
+	          << " s, " << count / std::max(elapsed, 1e-9) << " nodes/s";
+	if(options.checksum){ std::cout << ", checksum " << std::hex << checksum << std::dec; }
+	std::cout << std::endl;
+	return 0;
+}
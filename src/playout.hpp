@@ -1,16 +1,31 @@
 #pragma once
+#include <algorithm>
 #include "state.hpp"
 #include "random.hpp"
+#include "ntuple.hpp"
+#include "rollout_policy.hpp"
+#include "playout_stats.hpp"
 
-int playout(const State& root){
+// Plays random moves from `root` until the board is full, `max_plies` moves
+// were played (unless it is zero) or at most `stop_empty` cells are empty.
+// The quantum stones left are edges[edges_head, edges_tail); returns true
+// when the game ended. Pairs are drawn from `policy` when it is loaded and
+// uniformly otherwise.
+inline bool random_playout(
+	const State& root, int max_plies, int stop_empty, ClassicBoard& board,
+	std::array<State::Edge, 36>& edges, int& edges_head, int& edges_tail,
+	const rollout::Policy *policy = nullptr)
+{
 	using Edge = typename State::Edge;
-	ClassicBoard board = root.classic_board();
+	board = root.classic_board();
+	const stats::PlayoutTimer timer(36 - board.count(1) - board.count(-1));
 	int step = board.count(1) + board.count(-1) + root.edges().size();
+	const int stop_step = max_plies > 0 ? std::min(step + max_plies, 36) : 36;
 	// adjacency matrix and edge list
 	std::array<uint64_t, 36> graph;
 	for(int i = 0; i < 36; ++i){ graph[i] = 0; }
-	std::array<Edge, 36> edges;
-	int edges_head = 0, edges_tail = 0;
+	edges_head = 0;
+	edges_tail = 0;
 	for(const auto& e : root.edges()){
 		const int u = e.u, v = e.v;
 		edges[edges_tail++] = e;
@@ -36,7 +51,11 @@ int playout(const State& root){
 			}
 		}
 	}
+	const bool use_policy = policy && policy->is_open();
+	rollout::Sampler sampler(policy);
+	if(use_policy){ sampler.reset(board, group.data()); }
 	for(; step < 36; ++step){
+		if(step >= stop_step){ return false; }
 		const int color = 1 - 2 * (step & 1);
 		// list unoccupied cells
 		const uint64_t unused =
@@ -46,14 +65,22 @@ int playout(const State& root){
 		for(uint64_t b = unused; b > 0; b &= b - 1){
 			plist[pcount++] = __builtin_ctzll(b);
 		}
+		if(pcount <= stop_empty){ return false; }
+		stats::count_ply();
 		// check for the last turn
 		if(pcount == 1){
 			board.put(plist[0], color);
 			continue;
 		}
 		// select a pair of cells
-		const int k0 = modulus_random(pcount), k1 = modulus_random(pcount - 1);
-		const int p = plist[k0], q = plist[k1 + (k1 >= k0)];
+		int p, q;
+		if(use_policy){
+			sampler.select(color, p, q);
+		}else{
+			const int k0 = modulus_random(pcount), k1 = modulus_random(pcount - 1);
+			p = plist[k0];
+			q = plist[k1 + (k1 >= k0)];
+		}
 		if(group[p] == group[q]){
 			// entanglement
 			const int sel = (modulus_random(2) ? p : q);
@@ -76,17 +103,22 @@ int playout(const State& root){
 			const int before_head = edges_head;
 			edges_head = edges_tail;
 			board.put(sel, color);
+			int num_fixed = 1;
 			for(int i = edges_tail - 1; i >= before_head; --i){
 				const auto& e = edges[i];
 				const int u = e.u, v = e.v;
 				if(d[u] < d[v]){
 					board.put(v, e.color);
+					++num_fixed;
 				}else if(d[u] > d[v]){
 					board.put(u, e.color);
+					++num_fixed;
 				}else{
 					edges[--edges_head] = e;
 				}
 			}
+			stats::count_collapse(num_fixed);
+			if(use_policy){ sampler.reset(board, group.data()); }
 		}else{
 			// put quantum-stone
 			edges[edges_tail++] = Edge(p, q, color);
@@ -96,8 +128,17 @@ int playout(const State& root){
 			for(int i = 0; i < 36; ++i){
 				if(group[i] == gq){ group[i] = gp; }
 			}
+			if(use_policy){ sampler.merge(gp, gq); }
 		}
 	}
+	return true;
+}
+
+inline int playout(const State& root, const rollout::Policy *policy = nullptr){
+	ClassicBoard board;
+	std::array<State::Edge, 36> edges;
+	int edges_head, edges_tail;
+	random_playout(root, 0, 0, board, edges, edges_head, edges_tail, policy);
 
 	const int black = board.count( 1);
 	const int white = board.count(-1);
@@ -109,3 +150,57 @@ int playout(const State& root){
 		return 0;
 	}
 }
+
+// Settings of truncated playouts: they stop after `max_plies` random moves
+// or once at most `stop_empty` cells are empty, and the evaluator scores the
+// position they reached. Playouts starting at or below `stop_empty` empty
+// cells run to the end regardless of `max_plies`, so that endgame searches
+// stay exact.
+struct PlayoutCutoff {
+	const ntuple::Evaluator *evaluator;
+	int max_plies;    // zero for no limit
+	int stop_empty;   // zero for no limit
+
+	PlayoutCutoff()
+		: evaluator(nullptr)
+		, max_plies(0)
+		, stop_empty(0)
+	{ }
+
+	bool enabled() const {
+		return evaluator && evaluator->is_open() && (max_plies > 0 || stop_empty > 0);
+	}
+};
+
+// win probability of black after a playout stopped by `cutoff`; a game
+// played to the end gives 1, 0.5 or 0
+inline double truncated_playout(
+	const State& root, const PlayoutCutoff& cutoff, const rollout::Policy *policy = nullptr)
+{
+	const auto& root_board = root.classic_board();
+	const int empty = 36 - root_board.count(1) - root_board.count(-1);
+	const bool endgame = cutoff.stop_empty > 0 && empty <= cutoff.stop_empty;
+	const int max_plies = endgame ? 0 : cutoff.max_plies;
+	const int stop_empty = endgame ? 0 : cutoff.stop_empty;
+	ClassicBoard board;
+	std::array<State::Edge, 36> edges;
+	int edges_head, edges_tail;
+	if(random_playout(
+		root, max_plies, stop_empty, board, edges, edges_head, edges_tail, policy))
+	{
+		const int diff = board.count(1) - board.count(-1);
+		return diff > 0 ? 1.0 : (diff < 0 ? 0.0 : 0.5);
+	}
+	State s;
+	for(uint64_t b = board.bitmap(1); b; b &= b - 1){
+		s.force_put_classic(__builtin_ctzll(b), 1);
+	}
+	for(uint64_t b = board.bitmap(-1); b; b &= b - 1){
+		s.force_put_classic(__builtin_ctzll(b), -1);
+	}
+	for(int i = edges_head; i < edges_tail; ++i){
+		const auto& e = edges[i];
+		s.put(std::min<int>(e.u, e.v), std::max<int>(e.u, e.v), e.color);
+	}
+	return cutoff.evaluator->win_probability(s, 1);
+}
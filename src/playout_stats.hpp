@@ -0,0 +1,247 @@
+#pragma once
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+#include <sstream>
+#include <algorithm>
+
+// Counters of what playouts and State do: playouts, plies, cycle events and
+// the number of stones each of their collapses fixed, ClassicBoard::put
+// calls and the time of a playout by its number of empty cells at the
+// start. They are compiled in with -DPLAYOUT_STATS; without it every hook
+// below is an empty inline function and costs nothing.
+//
+// Each thread counts into its own counters, which only it writes, and
+// snapshot() merges those of all threads on demand.
+
+namespace stats {
+
+#ifdef PLAYOUT_STATS
+static constexpr bool ENABLED = true;
+#else
+static constexpr bool ENABLED = false;
+#endif
+
+template <typename T>
+struct Fields {
+	T playouts;
+	T plies;
+	T cycles;
+	T board_puts;
+	std::array<T, 37> collapse_lengths;   // cycle events by stones fixed
+	std::array<T, 37> playouts_by_empty;  // by empty cells at the start
+	std::array<T, 37> ns_by_empty;
+};
+
+struct Totals : public Fields<uint64_t> {
+
+	Totals(){
+		playouts = plies = cycles = board_puts = 0;
+		collapse_lengths.fill(0);
+		playouts_by_empty.fill(0);
+		ns_by_empty.fill(0);
+	}
+
+	// adds `sign` times the counters of `rhs`
+	template <typename T>
+	void add(const Fields<T>& rhs, int64_t sign = 1){
+		playouts += sign * rhs.playouts;
+		plies += sign * rhs.plies;
+		cycles += sign * rhs.cycles;
+		board_puts += sign * rhs.board_puts;
+		for(int i = 0; i <= 36; ++i){
+			collapse_lengths[i] += sign * rhs.collapse_lengths[i];
+			playouts_by_empty[i] += sign * rhs.playouts_by_empty[i];
+			ns_by_empty[i] += sign * rhs.ns_by_empty[i];
+		}
+	}
+
+	// one line of JSON
+	std::string to_json() const {
+		std::ostringstream oss;
+		oss << "{\"playout_stats\":{\"playouts\":" << playouts
+		    << ",\"plies\":" << plies << ",\"cycles\":" << cycles
+		    << ",\"board_puts\":" << board_puts << ",\"collapse_lengths\":[";
+		int last = 0;
+		for(int i = 0; i <= 36; ++i){
+			if(collapse_lengths[i]){ last = i; }
+		}
+		for(int i = 0; i <= last; ++i){
+			oss << (i ? "," : "") << collapse_lengths[i];
+		}
+		oss << "],\"by_empty\":[";
+		bool first = true;
+		for(int i = 0; i <= 36; ++i){
+			if(!playouts_by_empty[i]){ continue; }
+			oss << (first ? "" : ",") << "{\"empty\":" << i
+			    << ",\"playouts\":" << playouts_by_empty[i]
+			    << ",\"ns_per_playout\":" << ns_by_empty[i] / playouts_by_empty[i] << "}";
+			first = false;
+		}
+		oss << "]}}";
+		return oss.str();
+	}
+
+};
+
+namespace detail {
+
+typedef Fields<std::atomic<uint64_t>> Counters;
+
+// the counters of the running threads and the sum of those that exited
+class Registry {
+
+private:
+	std::mutex m_mutex;
+	std::vector<const Counters *> m_live;
+	Totals m_retired;
+	Totals m_reported;
+
+	Totals merge() const {
+		Totals totals = m_retired;
+		for(const auto c : m_live){ totals.add(*c); }
+		return totals;
+	}
+
+public:
+	void attach(const Counters *counters){
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_live.push_back(counters);
+	}
+
+	void detach(const Counters *counters){
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_retired.add(*counters);
+		m_live.erase(std::find(m_live.begin(), m_live.end(), counters));
+	}
+
+	Totals snapshot(){
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return merge();
+	}
+
+	// the counts since the last call
+	Totals take_delta(){
+		std::lock_guard<std::mutex> lock(m_mutex);
+		const Totals now = merge();
+		Totals delta = now;
+		delta.add(m_reported, -1);
+		m_reported = now;
+		return delta;
+	}
+
+};
+
+inline Registry& registry(){
+	static Registry instance;
+	return instance;
+}
+
+class LocalCounters {
+
+private:
+	Counters m_counters;
+
+public:
+	LocalCounters(){
+		m_counters.playouts = 0;
+		m_counters.plies = 0;
+		m_counters.cycles = 0;
+		m_counters.board_puts = 0;
+		for(int i = 0; i <= 36; ++i){
+			m_counters.collapse_lengths[i] = 0;
+			m_counters.playouts_by_empty[i] = 0;
+			m_counters.ns_by_empty[i] = 0;
+		}
+		registry().attach(&m_counters);
+	}
+
+	LocalCounters(const LocalCounters&) = delete;
+	LocalCounters& operator=(const LocalCounters&) = delete;
+
+	~LocalCounters(){
+		registry().detach(&m_counters);
+	}
+
+	Counters& get(){ return m_counters; }
+
+};
+
+inline Counters& local(){
+	static thread_local LocalCounters counters;
+	return counters.get();
+}
+
+// only the owning thread writes, so a relaxed load and store is enough
+inline void add(std::atomic<uint64_t>& counter, uint64_t n){
+	counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+}
+
+inline void count_board_put(){
+	if(ENABLED){ detail::add(detail::local().board_puts, 1); }
+}
+
+inline void count_ply(){
+	if(ENABLED){ detail::add(detail::local().plies, 1); }
+}
+
+// a cycle was closed and its collapse fixed `length` stones
+inline void count_collapse(int length){
+	if(ENABLED){
+		auto& counters = detail::local();
+		detail::add(counters.cycles, 1);
+		detail::add(counters.collapse_lengths[std::min(length, 36)], 1);
+	}
+}
+
+// counts a playout and its time over its lifetime
+class PlayoutTimer {
+
+private:
+	typedef std::chrono::steady_clock Clock;
+	int m_empty;
+	Clock::time_point m_start;
+
+public:
+	explicit PlayoutTimer(int empty)
+		: m_empty(empty)
+		, m_start()
+	{
+		if(ENABLED){ m_start = Clock::now(); }
+	}
+
+	PlayoutTimer(const PlayoutTimer&) = delete;
+	PlayoutTimer& operator=(const PlayoutTimer&) = delete;
+
+	~PlayoutTimer(){
+		if(ENABLED){
+			const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				Clock::now() - m_start).count();
+			auto& counters = detail::local();
+			detail::add(counters.playouts, 1);
+			detail::add(counters.playouts_by_empty[m_empty], 1);
+			detail::add(counters.ns_by_empty[m_empty], ns);
+		}
+	}
+
+};
+
+// the counters of all threads
+inline Totals snapshot(){
+	return detail::registry().snapshot();
+}
+
+// writes the counts since the last report as one line of JSON; does
+// nothing unless the counters are compiled in
+inline void report(std::ostream& os){
+	if(ENABLED){ os << detail::registry().take_delta().to_json() << std::endl; }
+}
+
+}
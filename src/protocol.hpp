@@ -0,0 +1,264 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstring>
+#include <utility>
+#include "state.hpp"
+
+// Fixed-schema parser for the referee's messages. It scans a line in place
+// and writes into a reusable Message, so no heap allocation happens once
+// the buffers have been reserved.
+
+static constexpr int PROTOCOL_MAX_MOVES = 64;
+
+enum class Action {
+	UNKNOWN,
+	INIT,
+	PLAY,
+	SELECT,
+	QUIT
+};
+
+struct Message {
+	Action action;
+	int index;                     // init: own player index
+	State board;                   // classic stones of "board"
+	std::vector<History> moves;    // "moves", normalized to p <= q
+	std::pair<int, int> entanglement;
+	bool binary_protocol;          // init: "protocol" is "binary"
+	int game_id;                   // server mode: game of the message
+
+	Message()
+		: action(Action::UNKNOWN)
+		, index(0)
+		, board()
+		, moves()
+		, entanglement(0, 0)
+		, binary_protocol(false)
+		, game_id(0)
+	{
+		moves.reserve(PROTOCOL_MAX_MOVES);
+	}
+};
+
+class ProtocolParser {
+
+private:
+	const char *m_cur;
+	const char *m_end;
+	char m_black;
+	char m_white;
+
+	void skip_spaces(){
+		while(m_cur < m_end && (*m_cur == ' ' || *m_cur == '\t' || *m_cur == '\r' || *m_cur == '\n')){
+			++m_cur;
+		}
+	}
+
+	bool consume(char c){
+		skip_spaces();
+		if(m_cur >= m_end || *m_cur != c){ return false; }
+		++m_cur;
+		return true;
+	}
+
+	// the contents of a string without unescaping them
+	bool parse_string(const char *& first, const char *& last){
+		if(!consume('"')){ return false; }
+		first = m_cur;
+		while(m_cur < m_end && *m_cur != '"'){
+			if(*m_cur == '\\'){ ++m_cur; }
+			++m_cur;
+		}
+		if(m_cur >= m_end){ return false; }
+		last = m_cur++;
+		return true;
+	}
+
+	bool parse_int(int& value){
+		skip_spaces();
+		bool negative = false;
+		if(m_cur < m_end && *m_cur == '-'){
+			negative = true;
+			++m_cur;
+		}
+		if(m_cur >= m_end || *m_cur < '0' || *m_cur > '9'){ return false; }
+		int x = 0;
+		while(m_cur < m_end && '0' <= *m_cur && *m_cur <= '9'){
+			x = x * 10 + (*m_cur++ - '0');
+		}
+		value = negative ? -x : x;
+		return true;
+	}
+
+	bool skip_value(){
+		skip_spaces();
+		if(m_cur >= m_end){ return false; }
+		if(*m_cur == '"'){
+			const char *first, *last;
+			return parse_string(first, last);
+		}
+		if(*m_cur == '[' || *m_cur == '{'){
+			const char close = (*m_cur == '[' ? ']' : '}');
+			++m_cur;
+			if(consume(close)){ return true; }
+			do {
+				if(close == '}'){
+					const char *first, *last;
+					if(!parse_string(first, last) || !consume(':')){ return false; }
+				}
+				if(!skip_value()){ return false; }
+			} while(consume(','));
+			return consume(close);
+		}
+		// number, true, false or null
+		const char *start = m_cur;
+		while(m_cur < m_end && *m_cur != ',' && *m_cur != ']' && *m_cur != '}' &&
+		      *m_cur != ' ' && *m_cur != '\t'){
+			++m_cur;
+		}
+		return m_cur != start;
+	}
+
+	static bool equals(const char *first, const char *last, const char *s){
+		const size_t n = strlen(s);
+		return static_cast<size_t>(last - first) == n && memcmp(first, s, n) == 0;
+	}
+
+	bool parse_action(Message& message){
+		const char *first, *last;
+		if(!parse_string(first, last)){ return false; }
+		if(equals(first, last, "init")){
+			message.action = Action::INIT;
+		}else if(equals(first, last, "play")){
+			message.action = Action::PLAY;
+		}else if(equals(first, last, "select")){
+			message.action = Action::SELECT;
+		}else if(equals(first, last, "quit")){
+			message.action = Action::QUIT;
+		}else{
+			message.action = Action::UNKNOWN;
+		}
+		return true;
+	}
+
+	bool parse_marker(char& marker){
+		const char *first, *last;
+		if(!parse_string(first, last)){ return false; }
+		if(last - first == 1){ marker = *first; }
+		return true;
+	}
+
+	bool parse_board(Message& message){
+		if(!consume('[')){ return false; }
+		for(int i = 0; i < 36; ++i){
+			if(i > 0 && !consume(',')){ return false; }
+			const char *first, *last;
+			if(!parse_string(first, last)){ return false; }
+			if(last - first != 1){ continue; }
+			if(*first == m_black){
+				message.board.force_put_classic(i, 1);
+			}else if(*first == m_white){
+				message.board.force_put_classic(i, -1);
+			}
+		}
+		return consume(']');
+	}
+
+	bool parse_moves(Message& message){
+		if(!consume('[')){ return false; }
+		if(consume(']')){ return true; }
+		do {
+			int p = 0, q = 0, select = -1;
+			if(!consume('[') || !consume('[') || !parse_int(p) || !consume(',') ||
+			   !parse_int(q) || !consume(']') || !consume(',') ||
+			   !parse_int(select) || !consume(']'))
+			{
+				return false;
+			}
+			if(p < 0 || p >= 36 || q < 0 || q >= 36){ return false; }
+			if(message.moves.size() >= PROTOCOL_MAX_MOVES){ return false; }
+			if(p > q){
+				std::swap(p, q);
+				if(select >= 0){ select = 1 - select; }
+			}
+			message.moves.emplace_back(p, q, select);
+		} while(consume(','));
+		return consume(']');
+	}
+
+	bool parse_entanglement(Message& message){
+		int p = 0, q = 0;
+		if(!consume('[') || !parse_int(p) || !consume(',') || !parse_int(q) || !consume(']')){
+			return false;
+		}
+		if(p < 0 || p >= 36 || q < 0 || q >= 36){ return false; }
+		message.entanglement = std::make_pair(p, q);
+		return true;
+	}
+
+public:
+	ProtocolParser()
+		: m_cur(nullptr)
+		, m_end(nullptr)
+		, m_black('o')
+		, m_white('x')
+	{ }
+
+	// "board" is read with the markers of the last init message
+	bool parse(const char *first, const char *last, Message& message){
+		m_cur = first;
+		m_end = last;
+		message.action = Action::UNKNOWN;
+		message.binary_protocol = false;
+		message.game_id = 0;
+		message.board = State();
+		message.moves.clear();
+		if(!consume('{')){ return false; }
+		if(consume('}')){ return true; }
+		// "board" may come before "black" and "white"
+		const char *board = nullptr;
+		do {
+			const char *key_first, *key_last;
+			if(!parse_string(key_first, key_last) || !consume(':')){ return false; }
+			bool ok = true;
+			if(equals(key_first, key_last, "action")){
+				ok = parse_action(message);
+			}else if(equals(key_first, key_last, "index")){
+				ok = parse_int(message.index);
+			}else if(equals(key_first, key_last, "board")){
+				skip_spaces();
+				board = m_cur;
+				ok = skip_value();
+			}else if(equals(key_first, key_last, "moves")){
+				ok = parse_moves(message);
+			}else if(equals(key_first, key_last, "entanglement")){
+				ok = parse_entanglement(message);
+			}else if(equals(key_first, key_last, "protocol")){
+				const char *first, *last;
+				ok = parse_string(first, last);
+				message.binary_protocol = ok && equals(first, last, "binary");
+			}else if(equals(key_first, key_last, "game_id")){
+				ok = parse_int(message.game_id);
+			}else if(equals(key_first, key_last, "black")){
+				ok = parse_marker(m_black);
+			}else if(equals(key_first, key_last, "white")){
+				ok = parse_marker(m_white);
+			}else{
+				ok = skip_value();
+			}
+			if(!ok){ return false; }
+		} while(consume(','));
+		if(!consume('}')){ return false; }
+		if(board){
+			m_cur = board;
+			if(!parse_board(message)){ return false; }
+		}
+		return true;
+	}
+
+	bool parse(const std::string& line, Message& message){
+		return parse(line.data(), line.data() + line.size(), message);
+	}
+
+};
@@ -0,0 +1,157 @@
+// Embeddable engine library with a C ABI
+// g++ src/qr_engine.cpp -std=c++14 -O3 -shared -fPIC -o libqrengine.so
+#include <new>
+#include <utility>
+#include <vector>
+#include "qr_engine.h"
+#include "state.hpp"
+#include "mcts.hpp"
+#include "game_tracker.hpp"
+#include "binary_protocol.hpp"
+
+struct qr_engine {
+	mcts::MCTSSolver solver;
+	GameTracker tracker;
+	uint32_t seed;
+	bool has_result;
+	int best_p, best_q;
+	std::vector<mcts::RootStatistics> root_statistics;
+
+	explicit qr_engine(uint32_t seed)
+		: solver()
+		, tracker()
+		, seed(seed)
+		, has_result(false)
+		, best_p(0)
+		, best_q(0)
+		, root_statistics()
+	{ }
+};
+
+extern "C" {
+
+// no exception may leave these functions; the ones that allocate report a
+// failure as QR_ERROR_INTERNAL
+
+qr_engine *qr_engine_create(uint32_t seed){
+	return new(std::nothrow) qr_engine(seed);
+}
+
+void qr_engine_destroy(qr_engine *engine){
+	delete engine;
+}
+
+int qr_engine_set_position(qr_engine *engine, const uint16_t *moves, int num_moves){
+	if(!engine || (!moves && num_moves > 0) || num_moves < 4 || num_moves > BINARY_MAX_MOVES){
+		return QR_ERROR_ARGUMENT;
+	}
+	engine->has_result = false;
+	try{
+		std::vector<History> history;
+		for(int i = 0; i < num_moves; ++i){ history.push_back(unpack_move(moves[i])); }
+		// built aside, so that a failure leaves the game as it was
+		GameTracker tracker;
+		if(!tracker.rebuild(history)){
+			engine->tracker.reset();
+			return QR_ERROR_ILLEGAL;
+		}
+		engine->tracker = std::move(tracker);
+		return QR_OK;
+	}catch(...){
+		return QR_ERROR_INTERNAL;
+	}
+}
+
+int qr_engine_apply_move(qr_engine *engine, int p, int q){
+	if(!engine || p < 0 || p >= 36 || q < 0 || q >= 36){ return QR_ERROR_ARGUMENT; }
+	engine->has_result = false;
+	try{
+		if(!engine->tracker.play(p, q)){ return QR_ERROR_ILLEGAL; }
+		return engine->tracker.has_pending() ? 1 : QR_OK;
+	}catch(...){
+		return QR_ERROR_INTERNAL;
+	}
+}
+
+int qr_engine_apply_select(qr_engine *engine, int cell){
+	if(!engine || cell < 0 || cell >= 36){ return QR_ERROR_ARGUMENT; }
+	if(!engine->tracker.has_pending()){ return QR_ERROR_STATE; }
+	engine->has_result = false;
+	try{
+		if(!engine->tracker.select(cell)){ return QR_ERROR_ILLEGAL; }
+		return QR_OK;
+	}catch(...){
+		return QR_ERROR_INTERNAL;
+	}
+}
+
+int qr_engine_position(
+	const qr_engine *engine, uint64_t *black, uint64_t *white,
+	int *step, int *pending_p, int *pending_q)
+{
+	if(!engine){ return QR_ERROR_ARGUMENT; }
+	const auto& tracker = engine->tracker;
+	const auto& board = tracker.state().classic_board();
+	if(black){ *black = board.bitmap(1); }
+	if(white){ *white = board.bitmap(-1); }
+	if(step){ *step = tracker.step(); }
+	const auto pending =
+		tracker.has_pending() ? tracker.pending_move() : std::make_pair(-1, -1);
+	if(pending_p){ *pending_p = pending.first; }
+	if(pending_q){ *pending_q = pending.second; }
+	return QR_OK;
+}
+
+int qr_engine_search(qr_engine *engine, double seconds, int max_playouts){
+	if(!engine || seconds < 0.0 || max_playouts < 0){ return QR_ERROR_ARGUMENT; }
+	const auto& tracker = engine->tracker;
+	const auto& board = tracker.state().classic_board();
+	if(board.count(1) + board.count(-1) == 36){ return QR_ERROR_STATE; }
+	set_seed(engine->seed++);
+	const mcts::TimeManager::duration_type budget(seconds);
+	engine->has_result = false;
+	try{
+		if(tracker.has_pending()){
+			const auto pending = tracker.pending_move();
+			const int cell = engine->solver.analyze_select(
+				tracker.state(), pending.first, pending.second,
+				tracker.step() - 1, budget, max_playouts);
+			engine->best_p = engine->best_q = cell;
+		}else{
+			const auto best = engine->solver.analyze(
+				tracker.state(), tracker.step(), budget, max_playouts);
+			engine->best_p = best.p;
+			engine->best_q = best.q;
+		}
+		engine->root_statistics = engine->solver.root_statistics();
+	}catch(...){
+		return QR_ERROR_INTERNAL;
+	}
+	engine->has_result = true;
+	return QR_OK;
+}
+
+int qr_engine_best_move(const qr_engine *engine, int *p, int *q){
+	if(!engine || !p || !q){ return QR_ERROR_ARGUMENT; }
+	if(!engine->has_result){ return QR_ERROR_STATE; }
+	*p = engine->best_p;
+	*q = engine->best_q;
+	return QR_OK;
+}
+
+int qr_engine_root_stats(const qr_engine *engine, qr_move_stats *stats, int capacity){
+	if(!engine || (!stats && capacity > 0) || capacity < 0){ return QR_ERROR_ARGUMENT; }
+	if(!engine->has_result){ return QR_ERROR_STATE; }
+	const auto& root_statistics = engine->root_statistics;
+	const int n = static_cast<int>(root_statistics.size());
+	for(int i = 0; i < n && i < capacity; ++i){
+		const auto& s = root_statistics[i];
+		stats[i].p = s.move.p;
+		stats[i].q = s.move.q;
+		stats[i].num_wins = static_cast<int>(s.num_wins + 0.5);
+		stats[i].num_playouts = s.num_playouts;
+	}
+	return n;
+}
+
+}
@@ -0,0 +1,64 @@
+#ifndef QR_ENGINE_H
+#define QR_ENGINE_H
+
+/*
+ * C interface of the quantum reversi engine.
+ *
+ * Moves are packed as in the binary protocol:
+ *   p | q << 6 | collapsed << 12 | select << 13
+ * with p <= q, where select tells which of the two cells a collapsed move
+ * took. A move list always starts with the 4 initial stones.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define QR_OK               0
+#define QR_ERROR_ARGUMENT  -1
+#define QR_ERROR_ILLEGAL   -2
+#define QR_ERROR_STATE     -3
+#define QR_ERROR_INTERNAL  -4  /* out of memory or another failure inside the engine */
+
+typedef struct qr_engine qr_engine;
+
+typedef struct qr_move_stats {
+	int p, q;              /* p == q for selections */
+	int num_wins;          /* from the point of view of the side to move, rounded */
+	int num_playouts;
+} qr_move_stats;
+
+qr_engine *qr_engine_create(uint32_t seed);
+void qr_engine_destroy(qr_engine *engine);
+
+/* replaces the game by the packed move list */
+int qr_engine_set_position(qr_engine *engine, const uint16_t *moves, int num_moves);
+
+/* plays a pair; returns 1 when it closed a cycle and a selection follows */
+int qr_engine_apply_move(qr_engine *engine, int p, int q);
+
+/* resolves the pending cycle with one of its cells */
+int qr_engine_apply_select(qr_engine *engine, int cell);
+
+/* current position: classic stones, number of moves, pending cycle */
+int qr_engine_position(
+	const qr_engine *engine, uint64_t *black, uint64_t *white,
+	int *step, int *pending_p, int *pending_q);
+
+/* searches the side to move for `seconds` or `max_playouts` root playouts
+ * (no playout limit when zero) */
+int qr_engine_search(qr_engine *engine, double seconds, int max_playouts);
+
+/* result of the last search; q == p for a selection */
+int qr_engine_best_move(const qr_engine *engine, int *p, int *q);
+
+/* root children of the last search; returns their total count */
+int qr_engine_root_stats(const qr_engine *engine, qr_move_stats *stats, int capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,79 @@
+// Rules library with a C ABI
+// g++ src/qr_rules.cpp -std=c++14 -O3 -shared -fPIC -o libqrrules.so
+#include <new>
+#include <vector>
+#include "qr_rules.h"
+#include "state.hpp"
+#include "game_tracker.hpp"
+#include "binary_protocol.hpp"
+
+struct qr_rules {
+	GameTracker tracker;
+};
+
+extern "C" {
+
+qr_rules *qr_rules_create(void){
+	return new(std::nothrow) qr_rules();
+}
+
+void qr_rules_destroy(qr_rules *rules){
+	delete rules;
+}
+
+void qr_rules_reset(qr_rules *rules){
+	if(rules){ rules->tracker.reset(); }
+}
+
+int qr_rules_play(qr_rules *rules, int p, int q){
+	if(!rules || p < 0 || p >= 36 || q < 0 || q >= 36){ return QR_ERROR_ARGUMENT; }
+	if(!rules->tracker.play(p, q)){ return QR_ERROR_ILLEGAL; }
+	return rules->tracker.has_pending() ? 1 : QR_OK;
+}
+
+int qr_rules_select(qr_rules *rules, int cell){
+	if(!rules || cell < 0 || cell >= 36){ return QR_ERROR_ARGUMENT; }
+	if(!rules->tracker.has_pending()){ return QR_ERROR_STATE; }
+	if(!rules->tracker.select(cell)){ return QR_ERROR_ILLEGAL; }
+	return QR_OK;
+}
+
+int qr_rules_board(
+	const qr_rules *rules, uint64_t *black, uint64_t *white, uint64_t *quantum)
+{
+	if(!rules){ return QR_ERROR_ARGUMENT; }
+	const auto& tracker = rules->tracker;
+	const auto& board = tracker.state().classic_board();
+	if(black){ *black = board.bitmap(1); }
+	if(white){ *white = board.bitmap(-1); }
+	if(quantum){
+		uint64_t cells = 0;
+		for(const auto& e : tracker.state().edges()){
+			cells |= (1ul << e.u) | (1ul << e.v);
+		}
+		if(tracker.has_pending()){
+			const auto pending = tracker.pending_move();
+			cells |= (1ul << pending.first) | (1ul << pending.second);
+		}
+		*quantum = cells;
+	}
+	return QR_OK;
+}
+
+int qr_rules_moves(const qr_rules *rules, uint16_t *moves, int capacity){
+	if(!rules || (!moves && capacity > 0) || capacity < 0){ return QR_ERROR_ARGUMENT; }
+	const auto& history = rules->tracker.history();
+	const int n = static_cast<int>(history.size());
+	for(int i = 0; i < n && i < capacity; ++i){ moves[i] = pack_move(history[i]); }
+	return n;
+}
+
+int qr_rules_entanglement(const qr_rules *rules, int *indices, int capacity){
+	if(!rules || (!indices && capacity > 0) || capacity < 0){ return QR_ERROR_ARGUMENT; }
+	const auto component = rules->tracker.pending_component();
+	const int n = static_cast<int>(component.size());
+	for(int i = 0; i < n && i < capacity; ++i){ indices[i] = component[i]; }
+	return n;
+}
+
+}
@@ -0,0 +1,51 @@
+#ifndef QR_RULES_H
+#define QR_RULES_H
+
+/*
+ * C interface of the rules alone, for referees and tools that do not need
+ * the search. Moves are packed as in qr_engine.h and the game starts from
+ * the 4 initial stones.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* same codes as qr_engine.h */
+#define QR_OK               0
+#define QR_ERROR_ARGUMENT  -1
+#define QR_ERROR_ILLEGAL   -2
+#define QR_ERROR_STATE     -3
+
+typedef struct qr_rules qr_rules;
+
+qr_rules *qr_rules_create(void);
+void qr_rules_destroy(qr_rules *rules);
+
+/* back to the initial position */
+void qr_rules_reset(qr_rules *rules);
+
+/* plays a pair; returns 1 when it closed a cycle and a selection follows */
+int qr_rules_play(qr_rules *rules, int p, int q);
+
+/* resolves the pending cycle with one of its cells */
+int qr_rules_select(qr_rules *rules, int cell);
+
+/* classic stones and the cells of uncollapsed moves */
+int qr_rules_board(
+	const qr_rules *rules, uint64_t *black, uint64_t *white, uint64_t *quantum);
+
+/* packed move list; returns its total length */
+int qr_rules_moves(const qr_rules *rules, uint16_t *moves, int capacity);
+
+/* indices of the moves collapsed by the pending selection, the pending
+ * move first and the others in decreasing order; returns their count */
+int qr_rules_entanglement(const qr_rules *rules, int *indices, int capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
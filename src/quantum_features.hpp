@@ -0,0 +1,155 @@
+#pragma once
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include "state.hpp"
+
+// Features of the quantum stones of a position. The edges of State form a
+// forest of components over the empty cells; a component of k cells has
+// k - 1 edges until a move inside it closes a cycle, and then every cell
+// of it gets one of the k stones. A component whose stones all have one
+// color therefore gives that color to all of its cells but the one taking
+// the closing stone, whichever way it collapses (before the flips of the
+// collapse), while the colors of the cells of a mixed component depend on
+// the selection.
+
+enum QuantumFeature {
+	BLACK_EDGES = 0,         // quantum stones of black
+	WHITE_EDGES,
+	NUM_COMPONENTS,
+	LARGEST_COMPONENT,       // cells of the largest component
+	PAIR_CELLS,              // cells in components of 2 cells
+	TRIPLE_CELLS,            // cells in components of 3 cells
+	LARGE_CELLS,             // cells in components of 4 or more cells
+	BLACK_CELLS,             // cells of components with black stones only
+	WHITE_CELLS,             // cells of components with white stones only
+	MIXED_CELLS,             // cells whose color is still undecided
+	BLACK_CYCLE_MOVES,       // moves closing a cycle if black is to move
+	WHITE_CYCLE_MOVES,       // moves closing a cycle if white is to move
+	FREE_CELLS,              // empty cells without quantum stones
+	NUM_QUANTUM_FEATURES
+};
+
+class QuantumFeatures {
+
+public:
+	static constexpr int MAX_COMPONENTS = 18;
+
+private:
+	std::array<uint64_t, MAX_COMPONENTS> m_components;   // cell masks
+	int m_num_components;
+	std::array<int8_t, 36> m_group;      // component of a cell, -1 if none
+	uint64_t m_black_only;               // cells of single-color components
+	uint64_t m_white_only;
+	uint64_t m_mixed;
+	std::array<int, NUM_QUANTUM_FEATURES> m_counts;
+
+public:
+	QuantumFeatures()
+		: m_components()
+		, m_num_components(0)
+		, m_group()
+		, m_black_only(0)
+		, m_white_only(0)
+		, m_mixed(0)
+		, m_counts()
+	{
+		m_group.fill(-1);
+		m_counts.fill(0);
+	}
+
+	explicit QuantumFeatures(const State& s){
+		compute(s);
+	}
+
+	void compute(const State& s){
+		const auto edges = s.edges();
+		const size_t num_edges = edges.size();
+		// neighbors of each cell touched by an edge
+		std::array<uint64_t, 36> adjacent;
+		uint64_t touched = 0, black_touched = 0, white_touched = 0;
+		int num_black = 0;
+		for(const auto& e : edges){
+			const uint64_t u = 1ul << e.u, v = 1ul << e.v;
+			if(!(touched & u)){ adjacent[e.u] = 0; }
+			if(!(touched & v)){ adjacent[e.v] = 0; }
+			adjacent[e.u] |= v;
+			adjacent[e.v] |= u;
+			touched |= u | v;
+			if(e.color > 0){
+				black_touched |= u | v;
+				++num_black;
+			}else{
+				white_touched |= u | v;
+			}
+		}
+		m_group.fill(-1);
+		m_counts.fill(0);
+		m_num_components = 0;
+		m_black_only = m_white_only = m_mixed = 0;
+		for(uint64_t remaining = touched; remaining; ){
+			uint64_t cells = remaining & (~remaining + 1);
+			for(uint64_t frontier = cells; frontier; ){
+				const int c = __builtin_ctzll(frontier);
+				frontier &= frontier - 1;
+				const uint64_t added = adjacent[c] & ~cells;
+				cells |= added;
+				frontier |= added;
+			}
+			remaining &= ~cells;
+			const int k = __builtin_popcountll(cells);
+			const int id = m_num_components++;
+			m_components[id] = cells;
+			for(uint64_t b = cells; b; b &= b - 1){
+				m_group[__builtin_ctzll(b)] = static_cast<int8_t>(id);
+			}
+			if(!(cells & white_touched)){
+				m_black_only |= cells;
+			}else if(!(cells & black_touched)){
+				m_white_only |= cells;
+			}else{
+				m_mixed |= cells;
+			}
+			m_counts[LARGEST_COMPONENT] = std::max(m_counts[LARGEST_COMPONENT], k);
+			m_counts[k == 2 ? PAIR_CELLS : (k == 3 ? TRIPLE_CELLS : LARGE_CELLS)] += k;
+			// any two cells of a component close a cycle
+			m_counts[BLACK_CYCLE_MOVES] += k * (k - 1) / 2;
+		}
+		const auto& board = s.classic_board();
+		const int step = board.count(1) + board.count(-1) + static_cast<int>(num_edges);
+		if(step & 1){ std::swap(m_counts[BLACK_CYCLE_MOVES], m_counts[WHITE_CYCLE_MOVES]); }
+		const uint64_t empty = ((1ul << 36) - 1ul) & ~(board.bitmap(1) | board.bitmap(-1));
+		m_counts[BLACK_EDGES] = num_black;
+		m_counts[WHITE_EDGES] = static_cast<int>(num_edges) - m_counts[BLACK_EDGES];
+		m_counts[NUM_COMPONENTS] = m_num_components;
+		m_counts[BLACK_CELLS] = __builtin_popcountll(m_black_only);
+		m_counts[WHITE_CELLS] = __builtin_popcountll(m_white_only);
+		m_counts[MIXED_CELLS] = __builtin_popcountll(m_mixed);
+		m_counts[FREE_CELLS] = __builtin_popcountll(
+			empty & ~(m_black_only | m_white_only | m_mixed));
+	}
+
+	int num_components() const { return m_num_components; }
+	uint64_t component(int i) const { return m_components[i]; }
+	// component of `cell`, -1 if it has no quantum stone
+	int group(int cell) const { return m_group[cell]; }
+	uint64_t black_only() const { return m_black_only; }
+	uint64_t white_only() const { return m_white_only; }
+	// cells whose color depends on how their component collapses
+	uint64_t undecided() const { return m_mixed; }
+
+	int count(QuantumFeature f) const {
+		return m_counts[f];
+	}
+
+	// the counts scaled to about [0, 1]; cycle moves are divided by the
+	// number of pairs of 36 cells
+	void values(float *out) const {
+		for(int i = 0; i < NUM_QUANTUM_FEATURES; ++i){
+			const bool pairs = (i == BLACK_CYCLE_MOVES || i == WHITE_CYCLE_MOVES);
+			out[i] = m_counts[i] * (pairs ? 1.0f / 630.0f : 1.0f / 36.0f);
+		}
+	}
+
+};
@@ -10,7 +10,7 @@ private:
 	uint32_t w =  48382934u;
 
 public:
-	void set_seed(uint32_t s){
+	inline void set_seed(uint32_t s){
 		x = y = z = w = s;
 		(*this)();
 	}
@@ -23,9 +23,9 @@ public:
 	}
 };
 
-static XORShift128 g_rng;
+static thread_local XORShift128 g_rng;
 
-void set_seed(uint32_t s){
+inline void set_seed(uint32_t s){
 	g_rng.set_seed(s);
 }
 
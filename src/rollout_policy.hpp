@@ -0,0 +1,392 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include "state.hpp"
+#include "random.hpp"
+
+// Learned rollout policy of playouts. The player to move puts a pair (p, q)
+// of empty cells with probability proportional to exp(c[p] + c[q] + t(p, q)),
+// where the cell term
+//
+//   c[x] = position[class of x] + own[own stones around x]
+//        + opponent[opponent stones around x]
+//
+// counts the 8 neighbors of x, and the pair term t(p, q) is cycle[k] when p
+// and q are in one component of k empty cells, so that the move closes a
+// cycle, and merge[k] for the component of k cells the move makes
+// otherwise. Sizes are capped at MAX_SIZE. The policy keeps the
+// exponentials of the weights, so sampling a move needs no exp().
+
+namespace rollout {
+
+static constexpr uint32_t POLICY_MAGIC = 0x50525251u;  // "QRRP"
+static constexpr uint32_t POLICY_VERSION = 1;
+
+// cells equivalent under the symmetries of the board share a weight
+static constexpr int NUM_POSITIONS = 6;
+static constexpr int MAX_NEIGHBORS = 8;
+static constexpr int MAX_SIZE = 8;
+// bound of the trained weights, where their exponentials neither overflow
+// nor vanish
+static constexpr float MAX_WEIGHT = 8.0f;
+
+// offsets of the groups of weights
+static constexpr int POSITION_WEIGHTS = 0;
+static constexpr int OWN_WEIGHTS = POSITION_WEIGHTS + NUM_POSITIONS;
+static constexpr int OPPONENT_WEIGHTS = OWN_WEIGHTS + MAX_NEIGHBORS + 1;
+static constexpr int MERGE_WEIGHTS = OPPONENT_WEIGHTS + MAX_NEIGHBORS + 1;
+static constexpr int CYCLE_WEIGHTS = MERGE_WEIGHTS + MAX_SIZE + 1;
+static constexpr int NUM_WEIGHTS = CYCLE_WEIGHTS + MAX_SIZE + 1;
+
+struct PolicyHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_weights;
+	uint32_t reserved;
+};
+
+static_assert(sizeof(PolicyHeader) == 16, "unexpected PolicyHeader layout");
+
+// 0 for the corners up to 5 for the 4 center cells
+inline int position_class(int cell){
+	const int x = std::min(cell % 6, 5 - cell % 6);
+	const int y = std::min(cell / 6, 5 - cell / 6);
+	const int a = std::min(x, y), b = std::max(x, y);
+	return b * (b + 1) / 2 + a;
+}
+
+// the 8 neighbors of every cell
+inline const std::array<uint64_t, 36>& neighbors(){
+	struct Table {
+		std::array<uint64_t, 36> masks;
+		Table(){
+			for(int c = 0; c < 36; ++c){
+				masks[c] = 0;
+				for(int dy = -1; dy <= 1; ++dy){
+					for(int dx = -1; dx <= 1; ++dx){
+						const int x = c % 6 + dx, y = c / 6 + dy;
+						if((dx || dy) && x >= 0 && x < 6 && y >= 0 && y < 6){
+							masks[c] |= 1ul << (y * 6 + x);
+						}
+					}
+				}
+			}
+		}
+	};
+	static const Table table;
+	return table.masks;
+}
+
+// the weights of the cell term of `cell`
+inline void cell_features(int cell, int own, int opponent, int *out){
+	out[0] = POSITION_WEIGHTS + position_class(cell);
+	out[1] = OWN_WEIGHTS + own;
+	out[2] = OPPONENT_WEIGHTS + opponent;
+}
+
+// the weight of the pair term of a move making or closing a component of
+// `size` cells
+inline int pair_feature(bool cycle, int size){
+	return (cycle ? CYCLE_WEIGHTS : MERGE_WEIGHTS) + std::min(size, MAX_SIZE);
+}
+
+inline bool write_policy(const char *path, const std::vector<float>& weights){
+	if(weights.size() != static_cast<size_t>(NUM_WEIGHTS)){ return false; }
+	PolicyHeader header;
+	header.magic = POLICY_MAGIC;
+	header.version = POLICY_VERSION;
+	header.num_weights = NUM_WEIGHTS;
+	header.reserved = 0;
+	FILE *fp = fopen(path, "wb");
+	if(!fp){ return false; }
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	ok = ok && fwrite(weights.data(), sizeof(float), weights.size(), fp) == weights.size();
+	return (fclose(fp) == 0) && ok;
+}
+
+class Policy {
+
+private:
+	std::vector<float> m_weights;
+	// exp of the cell terms by cell, own and opponent stones around it
+	float m_cell[36][MAX_NEIGHBORS + 1][MAX_NEIGHBORS + 1];
+	float m_merge[MAX_SIZE + 1];
+	float m_cycle[MAX_SIZE + 1];
+
+public:
+	Policy()
+		: m_weights()
+	{ }
+
+	Policy(const Policy&) = delete;
+	Policy& operator=(const Policy&) = delete;
+
+	bool open(const char *path){
+		close();
+		FILE *fp = fopen(path, "rb");
+		if(!fp){ return false; }
+		PolicyHeader header;
+		std::vector<float> weights(NUM_WEIGHTS);
+		bool ok = fread(&header, sizeof(header), 1, fp) == 1 &&
+			header.magic == POLICY_MAGIC && header.version == POLICY_VERSION &&
+			header.num_weights == static_cast<uint32_t>(NUM_WEIGHTS);
+		ok = ok && fread(weights.data(), sizeof(float), NUM_WEIGHTS, fp) == NUM_WEIGHTS;
+		// nothing may follow
+		ok = ok && fgetc(fp) == EOF;
+		fclose(fp);
+		if(!ok){ return false; }
+		set_weights(weights);
+		return true;
+	}
+
+	void close(){
+		m_weights.clear();
+	}
+
+	bool is_open() const {
+		return !m_weights.empty();
+	}
+
+	const std::vector<float>& weights() const {
+		return m_weights;
+	}
+
+	void set_weights(const std::vector<float>& weights){
+		m_weights = weights;
+		const float *w = m_weights.data();
+		for(int c = 0; c < 36; ++c){
+			int f[3];
+			for(int own = 0; own <= MAX_NEIGHBORS; ++own){
+				for(int opponent = 0; opponent <= MAX_NEIGHBORS; ++opponent){
+					cell_features(c, own, opponent, f);
+					m_cell[c][own][opponent] = std::exp(w[f[0]] + w[f[1]] + w[f[2]]);
+				}
+			}
+		}
+		for(int k = 0; k <= MAX_SIZE; ++k){
+			m_merge[k] = std::exp(w[pair_feature(false, k)]);
+			m_cycle[k] = std::exp(w[pair_feature(true, k)]);
+		}
+	}
+
+	// exp of the cell term of `cell` with `own` and `opponent` stones
+	// around it
+	float cell_weight(int cell, int own, int opponent) const {
+		return m_cell[cell][own][opponent];
+	}
+
+	// exp of the pair term of a move making a component of `k` cells
+	float merge_weight(int k) const {
+		return m_merge[std::min(k, MAX_SIZE)];
+	}
+
+	// exp of the pair term of a move closing a cycle in `k` cells
+	float cycle_weight(int k) const {
+		return m_cycle[std::min(k, MAX_SIZE)];
+	}
+
+};
+
+// The sampling state of a playout. The stones only change when a cycle
+// collapses, so the weights of the empty cells for both players and their
+// sums by component are rebuilt then; in between, a quantum stone merges two
+// components. A move sums up the pairs by component and by the capped size
+// of the components instead of going over all pairs. Pair masses are only
+// ever added up, never taken as differences of sums, so a class or a
+// component without a pair has none, and a pair of two different cells or
+// components is drawn directly, without retries.
+class Sampler {
+
+private:
+	const Policy *m_policy;
+	// by player to move (black, white) and cell or label of a component
+	float m_weight[2][36];
+	float m_sum[2][36];
+	float m_pairs[2][36];                  // sum of w[p] * w[q] over p < q
+	uint64_t m_cells[36];                  // empty cells by label
+	uint64_t m_classes[MAX_SIZE + 1];      // labels by capped size
+
+	static float uniform(){
+		return (xorshift128() >> 8) * (1.0f / 16777216.0f);
+	}
+
+	static int size_class(uint64_t cells){
+		return std::min(__builtin_popcountll(cells), MAX_SIZE);
+	}
+
+	// a member of `set` with probability proportional to its weight; rounding
+	// falls back to the last member
+	static int pick(uint64_t set, const float *weight, float total){
+		float r = uniform() * total;
+		int x = __builtin_ctzll(set);
+		for(; set; set &= set - 1){
+			x = __builtin_ctzll(set);
+			r -= weight[x];
+			if(r < 0.0f){ break; }
+		}
+		return x;
+	}
+
+	// Two different members a < b of `set`, which has at least two, with
+	// probability proportional to weight[a] * weight[b]: the first is drawn
+	// by its weight times the weight of the others, the second from the
+	// others by its weight. The weight of the others is summed from both
+	// ends, as the total minus the weight cancels when one member dominates.
+	static void pick_pair(uint64_t set, const float *weight, int& a, int& b){
+		float rest[36], mass[36];
+		float prefix = 0.0f;
+		for(uint64_t s = set; s; s &= s - 1){
+			const int x = __builtin_ctzll(s);
+			rest[x] = prefix;
+			prefix += weight[x];
+		}
+		float suffix = 0.0f, total = 0.0f;
+		for(uint64_t s = set; s; s &= ~(1ul << (63 - __builtin_clzll(s)))){
+			const int x = 63 - __builtin_clzll(s);
+			rest[x] += suffix;
+			suffix += weight[x];
+			mass[x] = weight[x] * rest[x];
+			total += mass[x];
+		}
+		a = pick(set, mass, total);
+		b = pick(set & ~(1ul << a), weight, rest[a]);
+		if(a > b){ std::swap(a, b); }
+	}
+
+	void insert(int g){
+		m_classes[size_class(m_cells[g])] |= 1ul << g;
+	}
+
+	void erase(int g){
+		m_classes[size_class(m_cells[g])] &= ~(1ul << g);
+	}
+
+public:
+	// `policy` is loaded
+	explicit Sampler(const Policy *policy)
+		: m_policy(policy)
+	{ }
+
+	// `group` labels the components of the empty cells of `board`
+	void reset(const ClassicBoard& board, const int *group){
+		const auto& masks = neighbors();
+		const uint64_t black = board.bitmap(1), white = board.bitmap(-1);
+		const uint64_t empty = ((1ul << 36) - 1ul) & ~(black | white);
+		uint64_t labels = 0;
+		for(uint64_t b = empty; b; b &= b - 1){
+			const int c = __builtin_ctzll(b);
+			const int g = group[c];
+			if(!(labels & (1ul << g))){
+				labels |= 1ul << g;
+				m_cells[g] = 0;
+				m_sum[0][g] = m_sum[1][g] = m_pairs[0][g] = m_pairs[1][g] = 0.0f;
+			}
+			m_cells[g] |= 1ul << c;
+			const int around_black = __builtin_popcountll(masks[c] & black);
+			const int around_white = __builtin_popcountll(masks[c] & white);
+			const float e[2] = {
+				m_policy->cell_weight(c, around_black, around_white),
+				m_policy->cell_weight(c, around_white, around_black)
+			};
+			for(int i = 0; i < 2; ++i){
+				m_weight[i][c] = e[i];
+				m_pairs[i][g] += e[i] * m_sum[i][g];
+				m_sum[i][g] += e[i];
+			}
+		}
+		for(int k = 0; k <= MAX_SIZE; ++k){ m_classes[k] = 0; }
+		for(uint64_t b = labels; b; b &= b - 1){ insert(__builtin_ctzll(b)); }
+	}
+
+	// the component `gq` joins `gp`
+	void merge(int gp, int gq){
+		if(gp == gq){ return; }
+		erase(gp);
+		erase(gq);
+		m_cells[gp] |= m_cells[gq];
+		for(int i = 0; i < 2; ++i){
+			m_pairs[i][gp] += m_pairs[i][gq] + m_sum[i][gp] * m_sum[i][gq];
+			m_sum[i][gp] += m_sum[i][gq];
+		}
+		insert(gp);
+	}
+
+	// a pair p < q for `color` to put; at least 2 cells are empty
+	void select(int color, int& p, int& q) const {
+		const int ci = color > 0 ? 0 : 1;
+		const float *weight = m_weight[ci], *sum = m_sum[ci], *pairs = m_pairs[ci];
+		// pairs closing a cycle, by component, and the sums of the classes
+		// with the pairs of two of their components
+		float within[36];
+		float class_sum[MAX_SIZE + 1], class_pairs[MAX_SIZE + 1];
+		float total = 0.0f;
+		int classes[MAX_SIZE + 1], num_classes = 0;
+		for(int k = 1; k <= MAX_SIZE; ++k){
+			if(!m_classes[k]){ continue; }
+			classes[num_classes++] = k;
+			class_sum[k] = class_pairs[k] = 0.0f;
+			for(uint64_t b = m_classes[k]; b; b &= b - 1){
+				const int g = __builtin_ctzll(b);
+				class_pairs[k] += sum[g] * class_sum[k];
+				class_sum[k] += sum[g];
+				if(k < 2){ continue; }
+				within[g] = m_policy->cycle_weight(k) * pairs[g];
+				total += within[g];
+			}
+		}
+		// pairs of components of the classes s <= t
+		float across[(MAX_SIZE + 1) * (MAX_SIZE + 1)];
+		for(int i = 0; i < num_classes; ++i){
+			for(int j = i; j < num_classes; ++j){
+				const int s = classes[i], t = classes[j];
+				const float mass = i == j ? class_pairs[s] : class_sum[s] * class_sum[t];
+				across[i * (MAX_SIZE + 1) + j] = m_policy->merge_weight(s + t) * mass;
+				total += across[i * (MAX_SIZE + 1) + j];
+			}
+		}
+		float r = uniform() * total;
+		for(int k = 2; k <= MAX_SIZE; ++k){
+			for(uint64_t b = m_classes[k]; b; b &= b - 1){
+				const int g = __builtin_ctzll(b);
+				r -= within[g];
+				if(r >= 0.0f || within[g] <= 0.0f){ continue; }
+				pick_pair(m_cells[g], weight, p, q);
+				return;
+			}
+		}
+		for(int i = 0; i < num_classes; ++i){
+			for(int j = i; j < num_classes; ++j){
+				const float w = across[i * (MAX_SIZE + 1) + j];
+				r -= w;
+				if(r >= 0.0f || w <= 0.0f){ continue; }
+				// a component of each class, two different ones for i == j
+				const int s = classes[i], t = classes[j];
+				int a, b;
+				if(i == j){
+					pick_pair(m_classes[s], sum, a, b);
+				}else{
+					a = pick(m_classes[s], sum, class_sum[s]);
+					b = pick(m_classes[t], sum, class_sum[t]);
+				}
+				p = pick(m_cells[a], weight, sum[a]);
+				q = pick(m_cells[b], weight, sum[b]);
+				if(p > q){ std::swap(p, q); }
+				return;
+			}
+		}
+		// rounding left nothing: the first and the last empty cell
+		uint64_t empty = 0;
+		for(int k = 1; k <= MAX_SIZE; ++k){
+			for(uint64_t b = m_classes[k]; b; b &= b - 1){ empty |= m_cells[__builtin_ctzll(b)]; }
+		}
+		p = __builtin_ctzll(empty);
+		q = 63 - __builtin_clzll(empty);
+	}
+
+};
+
+}
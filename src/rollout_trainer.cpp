@@ -0,0 +1,314 @@
+// Fits the rollout policy of the playouts to the visit shares of self-play
+// records
+// g++ src/rollout_trainer.cpp -std=c++14 -O3 -pthread -o rollout_trainer
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <memory>
+#include <random>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include "state.hpp"
+#include "game_tracker.hpp"
+#include "game_record.hpp"
+#include "quantum_features.hpp"
+#include "rollout_policy.hpp"
+#include "training.hpp"
+
+struct TrainerOptions {
+	const char *output = "rollout.bin";
+	const char *initial = nullptr;   // weights to start from
+	int num_epochs = 4;
+	int batch_size = 256;
+	double learning_rate = 0.01;
+	double validation = 0.05;        // share of games held out
+	uint32_t seed = 1;
+	int num_threads = static_cast<int>(std::thread::hardware_concurrency());
+};
+
+// a searched placement with the features of its cells
+struct TrainingPosition {
+	uint64_t empty;
+	uint8_t own[36];            // stones around a cell
+	uint8_t opponent[36];
+	int8_t group[36];           // component of a cell, -1 without quantum stones
+	uint8_t size[36];           // cells of that component, 1 without quantum stones
+	uint8_t num_entries;
+	VisitEntry entries[RECORD_NUM_ENTRIES];
+};
+
+// the policy keeps its weights in a range where their exponentials neither
+// overflow nor vanish
+static constexpr double MAX_WEIGHT = rollout::MAX_WEIGHT;
+
+class Trainer {
+
+private:
+	struct Loss {
+		double cross_entropy;   // against the visit shares
+		long long hits;         // most likely pair is the most visited one
+		long long count;
+		Loss() : cross_entropy(0.0), hits(0), count(0) { }
+		void add(const Loss& other){
+			cross_entropy += other.cross_entropy;
+			hits += other.hits;
+			count += other.count;
+		}
+	};
+
+	TrainerOptions m_options;
+	std::vector<TrainingPosition> m_positions;
+	size_t m_num_training;
+	std::vector<double> m_weights;
+	training::Adam<double> m_optimizer;
+	std::vector<std::vector<double>> m_gradients;   // one per thread
+
+	void add(const GameTracker& tracker, const PositionStats& stats){
+		const State& state = tracker.state();
+		const auto& board = state.classic_board();
+		const uint64_t empty = ((1ul << 36) - 1ul) & ~(board.bitmap(1) | board.bitmap(-1));
+		if(__builtin_popcountll(empty) < 2){ return; }
+		TrainingPosition pos;
+		std::memset(&pos, 0, sizeof(pos));
+		pos.empty = empty;
+		const int color = 1 - 2 * (tracker.step() & 1);
+		const auto& masks = rollout::neighbors();
+		const QuantumFeatures features(state);
+		for(int c = 0; c < 36; ++c){
+			pos.own[c] = static_cast<uint8_t>(__builtin_popcountll(masks[c] & board.bitmap(color)));
+			pos.opponent[c] =
+				static_cast<uint8_t>(__builtin_popcountll(masks[c] & board.bitmap(-color)));
+			pos.group[c] = static_cast<int8_t>(features.group(c));
+			pos.size[c] = static_cast<uint8_t>(pos.group[c] < 0
+				? 1 : __builtin_popcountll(features.component(pos.group[c])));
+		}
+		pos.num_entries = stats.num_entries;
+		std::copy(stats.entries, stats.entries + stats.num_entries, pos.entries);
+		m_positions.push_back(pos);
+	}
+
+	// replays a game and extracts its searched placements
+	void extract(const GameRecordView& game){
+		training::replay(game, [this](const GameTracker& tracker, const PositionStats& stats){
+			if(stats.kind == PositionStats::PLACEMENT){ add(tracker, stats); }
+		});
+	}
+
+	// softmax over all pairs of the position; the gradient of the cross
+	// entropy is added to `grad` unless it is null
+	void process(const TrainingPosition& pos, double *grad, Loss& loss) const {
+		using namespace rollout;
+		const double *w = m_weights.data();
+		int cells[36], n = 0;
+		double cell_logit[36];
+		int cell_weights[36][3];
+		for(uint64_t b = pos.empty; b; b &= b - 1){
+			const int c = __builtin_ctzll(b);
+			cell_features(c, pos.own[c], pos.opponent[c], cell_weights[c]);
+			cell_logit[c] = w[cell_weights[c][0]] + w[cell_weights[c][1]] + w[cell_weights[c][2]];
+			cells[n++] = c;
+		}
+		const int num_pairs = n * (n - 1) / 2;
+		std::vector<double> logits(num_pairs), target(num_pairs, 0.0);
+		std::vector<int> pair_weights(num_pairs);
+		int index[36][36];
+		double max_logit = -1e300;
+		int best_pair = 0;
+		for(int i = 0, k = 0; i < n; ++i){
+			for(int j = i + 1; j < n; ++j, ++k){
+				const int p = cells[i], q = cells[j];
+				const bool cycle = pos.group[p] >= 0 && pos.group[p] == pos.group[q];
+				pair_weights[k] = pair_feature(cycle, cycle ? pos.size[p] : pos.size[p] + pos.size[q]);
+				logits[k] = cell_logit[p] + cell_logit[q] + w[pair_weights[k]];
+				if(logits[k] > max_logit){
+					max_logit = logits[k];
+					best_pair = k;
+				}
+				index[p][q] = index[q][p] = k;
+			}
+		}
+		double target_sum = 0.0;
+		int best_entry = -1;
+		for(int e = 0; e < pos.num_entries; ++e){
+			const auto& entry = pos.entries[e];
+			if(entry.p == entry.q || !(pos.empty >> entry.p & 1) || !(pos.empty >> entry.q & 1)){
+				continue;
+			}
+			target[index[entry.p][entry.q]] += entry.visits;
+			target_sum += entry.visits;
+			if(best_entry < 0){ best_entry = index[entry.p][entry.q]; }
+		}
+		if(target_sum <= 0.0){ return; }
+		double z = 0.0;
+		for(int k = 0; k < num_pairs; ++k){
+			logits[k] = std::exp(logits[k] - max_logit);
+			z += logits[k];
+		}
+		double cell_delta[36] = { 0.0 };
+		for(int i = 0, k = 0; i < n; ++i){
+			for(int j = i + 1; j < n; ++j, ++k){
+				const double pi = logits[k] / z, t = target[k] / target_sum;
+				if(t > 0.0){ loss.cross_entropy -= t * std::log(std::max(pi, 1e-30)); }
+				if(!grad){ continue; }
+				const double d = pi - t;
+				cell_delta[cells[i]] += d;
+				cell_delta[cells[j]] += d;
+				grad[pair_weights[k]] += d;
+			}
+		}
+		if(grad){
+			for(int i = 0; i < n; ++i){
+				for(int f = 0; f < 3; ++f){ grad[cell_weights[cells[i]][f]] += cell_delta[cells[i]]; }
+			}
+		}
+		loss.hits += best_pair == best_entry;
+		++loss.count;
+	}
+
+	// Adam over the summed gradients of the threads
+	void apply(int batch_size){
+		m_optimizer.step(m_weights.data(), [this, batch_size](size_t i){
+			double g = 0.0;
+			for(auto& grad : m_gradients){ g += grad[i]; }
+			return g / batch_size;
+		});
+		for(auto& w : m_weights){ w = std::max(-MAX_WEIGHT, std::min(MAX_WEIGHT, w)); }
+		for(auto& grad : m_gradients){ std::fill(grad.begin(), grad.end(), 0.0); }
+	}
+
+public:
+	// the positions of the last games of the last files are held out for
+	// validation; the weights start at zero, the uniform policy
+	Trainer(const TrainerOptions& options, const std::vector<std::unique_ptr<GameRecordFile>>& files)
+		: m_options(options)
+		, m_positions()
+		, m_num_training(0)
+		, m_weights(rollout::NUM_WEIGHTS, 0.0)
+		, m_optimizer(rollout::NUM_WEIGHTS, options.learning_rate)
+		, m_gradients(std::max(1, options.num_threads), std::vector<double>(rollout::NUM_WEIGHTS, 0.0))
+	{
+		training::split_games(files, options.validation, [this](
+			const GameRecordView& game, bool held_out)
+		{
+			extract(game);
+			if(!held_out){ m_num_training = m_positions.size(); }
+		});
+	}
+
+	bool load(const char *path){
+		rollout::Policy policy;
+		if(!policy.open(path)){ return false; }
+		std::copy(policy.weights().begin(), policy.weights().end(), m_weights.begin());
+		return true;
+	}
+
+	bool save(const char *path) const {
+		return rollout::write_policy(path, std::vector<float>(m_weights.begin(), m_weights.end()));
+	}
+
+	void run(){
+		std::cerr << std::fixed << std::setprecision(5);
+		std::cerr << m_num_training << " training positions, "
+		          << m_positions.size() - m_num_training << " validation positions" << std::endl;
+		std::mt19937 engine(m_options.seed);
+		const size_t batch_size = std::max(1, m_options.batch_size);
+		for(int epoch = 0; epoch < m_options.num_epochs; ++epoch){
+			const auto start = std::chrono::steady_clock::now();
+			std::shuffle(m_positions.begin(), m_positions.begin() + m_num_training, engine);
+			Loss train;
+			for(size_t begin = 0; begin < m_num_training; begin += batch_size){
+				const size_t end = std::min(begin + batch_size, m_num_training);
+				train.add(training::parallel_for<Loss>(
+					static_cast<int>(m_gradients.size()), begin, end, [this](int t, size_t i, Loss& loss)
+				{
+					process(m_positions[i], m_gradients[t].data(), loss);
+				}));
+				apply(static_cast<int>(end - begin));
+			}
+			const std::chrono::duration<double> elapsed =
+				std::chrono::steady_clock::now() - start;
+			const auto valid = training::parallel_for<Loss>(
+				static_cast<int>(m_gradients.size()), m_num_training, m_positions.size(), [this](
+					int, size_t i, Loss& loss)
+			{
+				process(m_positions[i], nullptr, loss);
+			});
+			const auto n = std::max<long long>(train.count, 1);
+			const auto m = std::max<long long>(valid.count, 1);
+			std::cerr << "epoch " << epoch << ": train cross entropy " << train.cross_entropy / n
+			          << " top-1 " << static_cast<double>(train.hits) / n
+			          << ", validation cross entropy " << valid.cross_entropy / m
+			          << " top-1 " << static_cast<double>(valid.hits) / m
+			          << " [" << train.count / elapsed.count() << " positions/s]" << std::endl;
+		}
+		std::cerr << "weights:";
+		for(const auto w : m_weights){ std::cerr << " " << w; }
+		std::cerr << std::endl;
+	}
+
+};
+
+static void usage(const char *name){
+	std::cerr << "Usage: " << name << " [options] records..." << std::endl;
+	std::cerr << "  -o path    : output policy (default: rollout.bin)" << std::endl;
+	std::cerr << "  -i path    : initial policy (default: uniform)" << std::endl;
+	std::cerr << "  -e epochs  : passes over the training positions (default: 4)" << std::endl;
+	std::cerr << "  -b size    : positions per update (default: 256)" << std::endl;
+	std::cerr << "  -l rate    : learning rate of Adam (default: 0.01)" << std::endl;
+	std::cerr << "  -v share   : share of games held out for validation (default: 0.05)" << std::endl;
+	std::cerr << "  -s seed    : seed of the shuffles (default: 1)" << std::endl;
+	std::cerr << "  -j threads : number of worker threads (default: all cores)" << std::endl;
+}
+
+int main(int argc, char *argv[]){
+	TrainerOptions options;
+	std::vector<const char *> paths;
+	for(int i = 1; i < argc; ++i){
+		if(argv[i][0] != '-'){
+			paths.push_back(argv[i]);
+			continue;
+		}
+		if(i + 1 >= argc){ usage(argv[0]); return 1; }
+		if(strcmp(argv[i], "-o") == 0){
+			options.output = argv[++i];
+		}else if(strcmp(argv[i], "-i") == 0){
+			options.initial = argv[++i];
+		}else if(strcmp(argv[i], "-e") == 0){
+			options.num_epochs = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "-b") == 0){
+			options.batch_size = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "-l") == 0){
+			options.learning_rate = atof(argv[++i]);
+		}else if(strcmp(argv[i], "-v") == 0){
+			options.validation = atof(argv[++i]);
+		}else if(strcmp(argv[i], "-s") == 0){
+			options.seed = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+		}else if(strcmp(argv[i], "-j") == 0){
+			options.num_threads = atoi(argv[++i]);
+		}else{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if(paths.empty()){
+		usage(argv[0]);
+		return 1;
+	}
+	std::vector<std::unique_ptr<GameRecordFile>> files;
+	if(!training::open_records(paths, files)){ return 1; }
+	Trainer trainer(options, files);
+	if(options.initial && !trainer.load(options.initial)){
+		std::cerr << "failed to load " << options.initial << std::endl;
+		return 1;
+	}
+	trainer.run();
+	if(!trainer.save(options.output)){
+		std::cerr << "failed to write " << options.output << std::endl;
+		return 1;
+	}
+	return 0;
+}
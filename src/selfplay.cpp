@@ -0,0 +1,246 @@
+// Self-play training data generator
+// g++ src/selfplay.cpp -std=c++14 -O3 -pthread -o selfplay
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include "state.hpp"
+#include "random.hpp"
+#include "mcts.hpp"
+#include "game_tracker.hpp"
+#include "game_record.hpp"
+
+struct SelfPlayOptions {
+	const char *output = "selfplay.bin";
+	int num_games = 100;
+	int num_playouts = 2000;  // root playouts per decision
+	double seconds = 60.0;    // search time limit per decision
+	int random_plies = 4;     // leading moves played at random
+	uint32_t seed = 1;
+	int num_threads = static_cast<int>(std::thread::hardware_concurrency());
+};
+
+class SelfPlay {
+
+private:
+	typedef std::chrono::steady_clock clock_type;
+
+	SelfPlayOptions m_options;
+	std::atomic<int> m_next_game;
+	std::mutex m_mutex;
+	GameRecordWriter m_writer;
+	int m_num_games;
+	size_t m_num_positions;
+	bool m_failed;
+	clock_type::time_point m_start_time;
+
+	static int random_cell(uint64_t free){
+		int k = modulus_random(__builtin_popcountll(free));
+		for(; k > 0; --k){ free &= free - 1; }
+		return __builtin_ctzll(free);
+	}
+
+	// a uniformly random move that does not close a cycle; false when none
+	// is found after a few tries
+	static bool random_move(const State& state, uint64_t free, int& p, int& q){
+		for(int i = 0; i < 64; ++i){
+			const int u = random_cell(free);
+			const int v = random_cell(free & ~(1ul << u));
+			p = std::min(u, v);
+			q = std::max(u, v);
+			if(!state.test_entanglement(p, q)){ return true; }
+		}
+		return false;
+	}
+
+	// games are seeded by their index, so a game does not depend on the
+	// thread playing it as long as the playout budget ends the searches
+	GameRecord play_game(mcts::MCTSSolver& solver, int game){
+		set_seed(m_options.seed * 1000003u + static_cast<uint32_t>(game) + 1u);
+		const mcts::TimeManager::duration_type budget(m_options.seconds);
+		GameTracker tracker;
+		GameRecord record;
+		record.random_plies = m_options.random_plies;
+		while(true){
+			const auto& board = tracker.state().classic_board();
+			const uint64_t free =
+				((1ul << 36) - 1ul) & ~(board.bitmap(1) | board.bitmap(-1));
+			if(free == 0){ break; }
+			const int ply = static_cast<int>(record.moves.size());
+			int p, q;
+			if(__builtin_popcountll(free) == 1){
+				p = q = __builtin_ctzll(free);
+			}else if(ply < m_options.random_plies && random_move(tracker.state(), free, p, q)){
+				// p and q are set
+			}else{
+				const auto best = solver.analyze(
+					tracker.state(), tracker.step(), budget, m_options.num_playouts);
+				record.positions.push_back(PositionStats::from_search(
+					PositionStats::PLACEMENT, ply, solver.root_statistics()));
+				p = best.p;
+				q = best.q;
+			}
+			tracker.play(p, q);
+			int select = 0;
+			if(tracker.has_pending()){
+				int cell = p;
+				if(p != q){
+					cell = solver.analyze_select(
+						tracker.state(), p, q, tracker.step() - 1,
+						budget, m_options.num_playouts);
+					record.positions.push_back(PositionStats::from_search(
+						PositionStats::SELECTION, ply, solver.root_statistics()));
+				}
+				tracker.select(cell);
+				select = (cell == q && p != q) ? 1 : 0;
+			}
+			record.moves.emplace_back(p, q, select);
+		}
+		const auto& board = tracker.state().classic_board();
+		record.score = board.count(1) - board.count(-1);
+		return record;
+	}
+
+	void worker(){
+		mcts::MCTSSolver solver;
+		// visit counts of UCB are closer to a policy than those of halving
+		solver.set_root_policy(mcts::MCTSSolver::RootPolicy::UCB);
+		while(true){
+			const int game = m_next_game++;
+			if(game >= m_options.num_games){ break; }
+			const auto record = play_game(solver, game);
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if(!m_writer.append(record)){
+				m_failed = true;
+				break;
+			}
+			++m_num_games;
+			m_num_positions += record.positions.size();
+			const std::chrono::duration<double> elapsed = clock_type::now() - m_start_time;
+			std::cerr << "game " << game << ": " << record.moves.size() << " moves, score "
+			          << record.score << " [" << m_num_games << " games, "
+			          << m_num_positions << " positions, "
+			          << m_num_positions / elapsed.count() << " positions/s]" << std::endl;
+		}
+	}
+
+public:
+	explicit SelfPlay(const SelfPlayOptions& options)
+		: m_options(options)
+		, m_next_game(0)
+		, m_mutex()
+		, m_writer()
+		, m_num_games(0)
+		, m_num_positions(0)
+		, m_failed(false)
+		, m_start_time()
+	{ }
+
+	bool run(){
+		if(!m_writer.open(m_options.output)){ return false; }
+		m_start_time = clock_type::now();
+		std::vector<std::thread> threads;
+		for(int i = 0; i < std::max(1, m_options.num_threads); ++i){
+			threads.emplace_back([this]{ worker(); });
+		}
+		for(auto& t : threads){ t.join(); }
+		return !m_failed;
+	}
+
+};
+
+// prints the games of a record file with the searched decisions
+static bool dump(const char *path){
+	GameRecordFile file;
+	if(!file.open(path)){ return false; }
+	std::cout << file.size() << " games, " << file.num_positions() << " positions" << std::endl;
+	for(size_t i = 0; i < file.size(); ++i){
+		const auto game = file.game(i);
+		std::cout << "game " << i << ": score " << game.score() << ", random plies "
+		          << game.random_plies() << std::endl;
+		GameTracker tracker;
+		int k = 0;
+		for(int ply = 0; ply < game.num_moves(); ++ply){
+			const auto h = game.move(ply);
+			std::cout << "  " << ply << ": " << h.p << "," << h.q;
+			if(!tracker.play(h.p, h.q)){
+				std::cout << " illegal" << std::endl;
+				return false;
+			}
+			if(tracker.has_pending()){
+				const int cell = h.select ? h.q : h.p;
+				tracker.select(cell);
+				std::cout << " -> " << cell;
+			}
+			for(; k < game.num_positions() && game.position(k).ply == ply; ++k){
+				const auto& stats = game.position(k);
+				std::cout << (stats.kind == PositionStats::SELECTION ? " | select" : " | place")
+				          << " value " << stats.value / 65535.0
+				          << " playouts " << stats.num_playouts
+				          << " children " << stats.num_children << " [";
+				for(int j = 0; j < stats.num_entries; ++j){
+					const auto& e = stats.entries[j];
+					std::cout << (j ? " " : "") << static_cast<int>(e.p) << ","
+					          << static_cast<int>(e.q) << ":" << e.visits / 65535.0;
+				}
+				std::cout << "]";
+			}
+			std::cout << std::endl;
+		}
+	}
+	return true;
+}
+
+static void usage(const char *name){
+	std::cerr << "Usage: " << name << " [options]" << std::endl;
+	std::cerr << "  -o path     : output file, appended to (default: selfplay.bin)" << std::endl;
+	std::cerr << "  -n games    : number of games (default: 100)" << std::endl;
+	std::cerr << "  -p playouts : root playouts per decision (default: 2000)" << std::endl;
+	std::cerr << "  -t seconds  : search time limit per decision (default: 60)" << std::endl;
+	std::cerr << "  -r plies    : leading moves played at random (default: 4)" << std::endl;
+	std::cerr << "  -s seed     : seed of the games (default: 1)" << std::endl;
+	std::cerr << "  -j threads  : number of worker threads (default: all cores)" << std::endl;
+	std::cerr << "  -d path     : print the games of a record file and exit" << std::endl;
+}
+
+int main(int argc, char *argv[]){
+	SelfPlayOptions options;
+	for(int i = 1; i < argc; ++i){
+		if(i + 1 >= argc){ usage(argv[0]); return 1; }
+		if(strcmp(argv[i], "-o") == 0){
+			options.output = argv[++i];
+		}else if(strcmp(argv[i], "-n") == 0){
+			options.num_games = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "-p") == 0){
+			options.num_playouts = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "-t") == 0){
+			options.seconds = atof(argv[++i]);
+		}else if(strcmp(argv[i], "-r") == 0){
+			options.random_plies = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "-s") == 0){
+			options.seed = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+		}else if(strcmp(argv[i], "-j") == 0){
+			options.num_threads = atoi(argv[++i]);
+		}else if(strcmp(argv[i], "-d") == 0){
+			const char *path = argv[++i];
+			if(!dump(path)){
+				std::cerr << "failed to read " << path << std::endl;
+				return 1;
+			}
+			return 0;
+		}else{
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	SelfPlay selfplay(options);
+	if(!selfplay.run()){
+		std::cerr << "failed to write " << options.output << std::endl;
+		return 1;
+	}
+	return 0;
+}
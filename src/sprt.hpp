@@ -0,0 +1,108 @@
+#pragma once
+#include <array>
+#include <cmath>
+#include <algorithm>
+
+// Sequential probability ratio test over game pairs. Both games of a pair
+// start from the same opening with colors swapped, and the pair score of
+// the first engine (0, 0.5, ..., 2) is counted as a pentanomial outcome,
+// which keeps the variance of the opening out of the test.
+
+inline double elo_to_score(double elo){
+	return 1.0 / (1.0 + std::pow(10.0, -elo / 400.0));
+}
+
+inline double score_to_elo(double score){
+	score = std::min(std::max(score, 1e-6), 1.0 - 1e-6);
+	return -400.0 * std::log10(1.0 / score - 1.0);
+}
+
+class SPRT {
+
+public:
+	enum class Result {
+		CONTINUE,
+		H0,        // elo <= elo0 accepted
+		H1         // elo >= elo1 accepted
+	};
+
+private:
+	double m_elo0;
+	double m_elo1;
+	double m_lower;
+	double m_upper;
+	std::array<int, 5> m_pairs;
+
+	// mean and variance of the per-game score of a pair; a tiny count is
+	// added to every outcome so that a one-sided result has a variance
+	void moments(double& mean, double& variance) const {
+		static const double prior = 1e-3;
+		const double n = num_pairs() + 5 * prior;
+		mean = variance = 0.0;
+		for(int i = 0; i < 5; ++i){ mean += (m_pairs[i] + prior) * (0.25 * i); }
+		mean /= n;
+		for(int i = 0; i < 5; ++i){
+			const double d = 0.25 * i - mean;
+			variance += (m_pairs[i] + prior) * d * d;
+		}
+		variance /= n;
+	}
+
+public:
+	SPRT(double elo0 = 0.0, double elo1 = 5.0, double alpha = 0.05, double beta = 0.05)
+		: m_elo0(elo0)
+		, m_elo1(elo1)
+		, m_lower(std::log(beta / (1.0 - alpha)))
+		, m_upper(std::log((1.0 - beta) / alpha))
+		, m_pairs()
+	{
+		m_pairs.fill(0);
+	}
+
+	// `score` is the sum of both games: 0, 0.5, 1, 1.5 or 2
+	void add_pair(double score){
+		const int i = static_cast<int>(std::lround(score * 2.0));
+		++m_pairs[std::min(std::max(i, 0), 4)];
+	}
+
+	int num_pairs() const {
+		int n = 0;
+		for(const auto x : m_pairs){ n += x; }
+		return n;
+	}
+
+	const std::array<int, 5>& pentanomial() const {
+		return m_pairs;
+	}
+
+	double lower_bound() const { return m_lower; }
+	double upper_bound() const { return m_upper; }
+
+	// log-likelihood ratio of H1 against H0 under the normal approximation
+	double llr() const {
+		double mean, variance;
+		moments(mean, variance);
+		if(num_pairs() < 2){ return 0.0; }
+		const double s0 = elo_to_score(m_elo0), s1 = elo_to_score(m_elo1);
+		return num_pairs() * (s1 - s0) * (2.0 * mean - s0 - s1) / (2.0 * variance);
+	}
+
+	Result status() const {
+		const double x = llr();
+		if(x >= m_upper){ return Result::H1; }
+		if(x <= m_lower){ return Result::H0; }
+		return Result::CONTINUE;
+	}
+
+	// Elo difference and the half width of its 95% confidence interval
+	void elo(double& estimate, double& error) const {
+		double mean, variance;
+		moments(mean, variance);
+		estimate = score_to_elo(mean);
+		error = 0.0;
+		if(num_pairs() < 2){ return; }
+		const double d = 1.96 * std::sqrt(variance / num_pairs());
+		error = 0.5 * (score_to_elo(mean + d) - score_to_elo(mean - d));
+	}
+
+};
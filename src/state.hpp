@@ -2,6 +2,9 @@
 #include <array>
 #include <cstdint>
 #include <cassert>
+#include <ostream>
+#include <algorithm>
+#include "playout_stats.hpp"
 
 template <typename T>
 class PointerRange {
@@ -54,7 +57,7 @@ private:
 		flipped |= (-outflank_y * 2) & mask_y;
 		flipped |= (-outflank_z * 2) & mask_z;
 		flipped |= (-outflank_w * 2) & mask_w;
-		mask_x = 0010101010101ul << pos;
+		mask_x = 0010101010100ul << pos;
 		mask_y = 0000000000076ul << pos;
 		mask_z = 0000204102040ul << pos;
 		mask_w = 0402010040200ul << pos;
@@ -92,6 +95,7 @@ public:
 
 	void put(int p, int color){
 		assert(get(p) == 0);
+		stats::count_board_put();
 		const int t = (1 - color) >> 1;
 		const auto f = flip(p, m_stones[t], m_stones[1 - t]);
 		m_stones[0] ^= f;
@@ -116,7 +120,7 @@ public:
 
 };
 
-std::ostream& operator<<(std::ostream& os, const ClassicBoard& b){
+inline std::ostream& operator<<(std::ostream& os, const ClassicBoard& b){
 	for(int i = 0; i < 6; ++i){
 		for(int j = 0; j < 6; ++j){ os << "x.o"[b.get(i * 6 + j) + 1]; }
 		os << std::endl;
@@ -161,7 +165,12 @@ public:
 	{ }
 
 	static State create_initial_state(){
-		return State();
+		State s;
+		s.force_put_classic(15,  1);
+		s.force_put_classic(14, -1);
+		s.force_put_classic(20,  1);
+		s.force_put_classic(21, -1);
+		return s;
 	}
 
 	const ClassicBoard& classic_board() const {
@@ -203,11 +212,14 @@ public:
 			}
 			if(reachable == before){ break; }
 		}
+		int num_fixed = 0;
 		for(int i = static_cast<int>(m_num_edges); i >= 0; --i){
 			if(fix_colors[i]){
 				m_classic_board.put(fix_positions[i], fix_colors[i]);
+				++num_fixed;
 			}
 		}
+		stats::count_collapse(num_fixed);
 		size_t tail = 0;
 		for(size_t i = 0; i < m_num_edges; ++i){
 			const auto& e = m_edges[i];
@@ -231,7 +243,7 @@ public:
 
 };
 
-std::ostream& operator<<(std::ostream& os, const State& s){
+inline std::ostream& operator<<(std::ostream& os, const State& s){
 	char lines[6][7] = { { 0 } };
 	for(int i = 0; i < 6; ++i){
 		for(int j = 0; j < 6; ++j){
@@ -0,0 +1,159 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <algorithm>
+#include "state.hpp"
+#include "hash.hpp"
+
+// The 8 symmetries of the 6x6 board. Transform t applies the transposition
+// when (t & 4), then the vertical flip when (t & 2), then the horizontal
+// flip when (t & 1).
+static constexpr int NUM_SYMMETRIES = 8;
+
+inline uint64_t delta_swap(uint64_t x, uint64_t mask, int shift){
+	const uint64_t t = ((x >> shift) ^ x) & mask;
+	return x ^ t ^ (t << shift);
+}
+
+inline uint64_t flip_horizontal(uint64_t x){
+	// reverse 6 bits of each row: swap 3-bit halves, then outer bits of them
+	x = ((x >> 3) & 0070707070707ul) | ((x & 0070707070707ul) << 3);
+	return (x & 0222222222222ul) |
+	       ((x & 0111111111111ul) << 2) | ((x >> 2) & 0111111111111ul);
+}
+
+inline uint64_t flip_vertical(uint64_t x){
+	// swap upper and lower 3 rows, then the outer rows of both halves
+	x = ((x >> 18) & 0777777ul) | ((x & 0777777ul) << 18);
+	return (x & 0007700007700ul) |
+	       ((x & 0000077000077ul) << 12) | ((x >> 12) & 0000077000077ul);
+}
+
+inline uint64_t transpose(uint64_t x){
+	// (r, c) and (c, r) are 5 * (c - r) bits apart
+	x = delta_swap(x, 0004020100402ul,  5);
+	x = delta_swap(x, 0000040201004ul, 10);
+	x = delta_swap(x, 0000000402010ul, 15);
+	x = delta_swap(x, 0000000004020ul, 20);
+	x = delta_swap(x, 0000000000040ul, 25);
+	return x;
+}
+
+inline uint64_t transform_bitmap(uint64_t x, int t){
+	if(t & 4){ x = transpose(x); }
+	if(t & 2){ x = flip_vertical(x); }
+	if(t & 1){ x = flip_horizontal(x); }
+	return x;
+}
+
+class SymmetryTables {
+
+private:
+	std::array<std::array<int8_t, 36>, NUM_SYMMETRIES> m_forward;
+	std::array<std::array<int8_t, 36>, NUM_SYMMETRIES> m_inverse;
+
+public:
+	SymmetryTables(){
+		for(int t = 0; t < NUM_SYMMETRIES; ++t){
+			for(int p = 0; p < 36; ++p){
+				const int q = __builtin_ctzll(transform_bitmap(1ul << p, t));
+				m_forward[t][p] = static_cast<int8_t>(q);
+				m_inverse[t][q] = static_cast<int8_t>(p);
+			}
+		}
+	}
+
+	int forward(int t, int p) const { return m_forward[t][p]; }
+	int inverse(int t, int p) const { return m_inverse[t][p]; }
+
+};
+
+inline const SymmetryTables& symmetry_tables(){
+	static const SymmetryTables tables;
+	return tables;
+}
+
+inline int transform_cell(int p, int t){
+	return symmetry_tables().forward(t, p);
+}
+
+inline int inverse_transform_cell(int p, int t){
+	return symmetry_tables().inverse(t, p);
+}
+
+inline State transform_state(const State& s, int t){
+	const auto& board = s.classic_board();
+	State r;
+	for(uint64_t b = transform_bitmap(board.bitmap(1), t); b; b &= b - 1){
+		r.force_put_classic(__builtin_ctzll(b), 1);
+	}
+	for(uint64_t b = transform_bitmap(board.bitmap(-1), t); b; b &= b - 1){
+		r.force_put_classic(__builtin_ctzll(b), -1);
+	}
+	for(const auto& e : s.edges()){
+		const int u = transform_cell(e.u, t), v = transform_cell(e.v, t);
+		r.put(std::min(u, v), std::max(u, v), e.color);
+	}
+	return r;
+}
+
+// lexicographic order over (black, white, edge sequence)
+inline bool state_less(const State& a, const State& b){
+	const auto& ba = a.classic_board();
+	const auto& bb = b.classic_board();
+	if(ba.bitmap(1) != bb.bitmap(1)){ return ba.bitmap(1) < bb.bitmap(1); }
+	if(ba.bitmap(-1) != bb.bitmap(-1)){ return ba.bitmap(-1) < bb.bitmap(-1); }
+	const auto ea = a.edges(), eb = b.edges();
+	const size_t n = std::min(ea.size(), eb.size());
+	for(size_t i = 0; i < n; ++i){
+		const int ka = (ea[i].u << 7) | (ea[i].v << 1) | (ea[i].color > 0);
+		const int kb = (eb[i].u << 7) | (eb[i].v << 1) | (eb[i].color > 0);
+		if(ka != kb){ return ka < kb; }
+	}
+	return ea.size() < eb.size();
+}
+
+inline bool state_equal(const State& a, const State& b){
+	return !state_less(a, b) && !state_less(b, a);
+}
+
+// the transform mapping `s` to its canonical form; the identity image is
+// the reference since transform_state() orders the cells of every edge
+inline int canonical_transform(const State& s){
+	State best = transform_state(s, 0);
+	int best_t = 0;
+	for(int t = 1; t < NUM_SYMMETRIES; ++t){
+		const State r = transform_state(s, t);
+		if(state_less(r, best)){
+			best = r;
+			best_t = t;
+		}
+	}
+	return best_t;
+}
+
+inline uint64_t canonical_hash(const State& s){
+	return hash_state(transform_state(s, canonical_transform(s)));
+}
+
+// bit t is set when transform t maps `s` onto itself
+inline uint32_t symmetry_stabilizer(const State& s){
+	const State identity = transform_state(s, 0);
+	uint32_t mask = 1;
+	for(int t = 1; t < NUM_SYMMETRIES; ++t){
+		if(state_equal(transform_state(s, t), identity)){ mask |= (1u << t); }
+	}
+	return mask;
+}
+
+// true when no transform in `stabilizer` maps the pair {p, q} onto a
+// lexicographically smaller pair (expects p < q)
+inline bool is_canonical_pair(int p, int q, uint32_t stabilizer){
+	for(uint32_t b = stabilizer & ~1u; b; b &= b - 1){
+		const int t = __builtin_ctz(b);
+		const int tp = transform_cell(p, t), tq = transform_cell(q, t);
+		const int lo = std::min(tp, tq), hi = std::max(tp, tq);
+		if(lo < p || (lo == p && hi < q)){ return false; }
+	}
+	return true;
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include "state.hpp"
+
+namespace mcts {
+
+// time never handed out to a search (protects against the referee's clock)
+static constexpr double TIME_SAFETY_MARGIN = 0.3;
+// time reserved for protocol and tree setup of every remaining decision
+static constexpr double TIME_RESERVE_PER_DECISION = 0.005;
+// relative weight of an entanglement selection against a stone placement
+static constexpr double TIME_SELECT_WEIGHT = 0.35;
+// extra weight given to the middle game
+static constexpr double TIME_CRITICAL_BONUS = 1.5;
+static constexpr double TIME_CRITICAL_CENTER = 18.0;
+static constexpr double TIME_CRITICAL_WIDTH = 7.0;
+
+class TimeManager {
+
+public:
+	using duration_type = std::chrono::duration<double>;
+
+private:
+	duration_type m_remaining_time;
+
+	static double phase_weight(int step){
+		const double x = (step - TIME_CRITICAL_CENTER) / TIME_CRITICAL_WIDTH;
+		return 1.0 + TIME_CRITICAL_BONUS * exp(-x * x);
+	}
+
+	// probability that a uniformly random pair closes a cycle
+	static double cycle_probability(const State& state){
+		const auto& board = state.classic_board();
+		const int empty = 36 - board.count(1) - board.count(-1);
+		if(empty < 2){ return 1.0; }
+		uint64_t visited = 0;
+		int same_component_pairs = 0;
+		for(const auto& root : state.edges()){
+			if(visited & (1ul << root.u)){ continue; }
+			uint64_t component = (1ul << root.u);
+			while(true){
+				const auto before = component;
+				for(const auto& e : state.edges()){
+					const uint64_t u = (1ul << e.u), v = (1ul << e.v);
+					if(component & (u | v)){ component |= u | v; }
+				}
+				if(component == before){ break; }
+			}
+			visited |= component;
+			const int size = __builtin_popcountll(component);
+			same_component_pairs += size * (size - 1) / 2;
+		}
+		return static_cast<double>(same_component_pairs) / (empty * (empty - 1) / 2);
+	}
+
+public:
+	explicit TimeManager(double time_limit)
+		: m_remaining_time(time_limit)
+	{ }
+
+	duration_type remaining_time() const {
+		return m_remaining_time;
+	}
+
+	void consume(duration_type elapsed){
+		m_remaining_time -= elapsed;
+	}
+
+	// time budget of a decision at `state` where the side to move plays `step`
+	duration_type allocate(
+		const State& state, int step, bool is_select, size_t num_children) const
+	{
+		if(num_children <= 1){ return duration_type(0.0); }
+		// own placements left in this game (including this one when placing)
+		const int own_moves = (36 - step + 1) / 2;
+		// expected number of selections requested from us later on
+		const double own_selects = own_moves * cycle_probability(state);
+		const double usable =
+			m_remaining_time.count() - TIME_SAFETY_MARGIN -
+			TIME_RESERVE_PER_DECISION * (own_moves + own_selects);
+		if(usable <= 0.0){ return duration_type(0.0); }
+		double total_weight = own_selects * TIME_SELECT_WEIGHT;
+		for(int i = 0; i < own_moves; ++i){
+			total_weight += phase_weight(step + 2 * i);
+		}
+		double weight = 0.0;
+		if(is_select){
+			weight = TIME_SELECT_WEIGHT;
+			total_weight += weight;
+		}else{
+			weight = phase_weight(step);
+		}
+		return duration_type(usable * weight / total_weight);
+	}
+
+	// true when `best_visits` can not be overtaken by `second_visits`
+	// within `remaining_playouts` further playouts
+	static bool is_decided(
+		int best_visits, int second_visits, double remaining_playouts)
+	{
+		return best_visits - second_visits > remaining_playouts;
+	}
+
+};
+
+}
@@ -0,0 +1,151 @@
+#pragma once
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <algorithm>
+#include <cmath>
+#include "game_tracker.hpp"
+#include "game_record.hpp"
+
+// Plumbing shared by the offline trainers: reading the record files, the
+// split of the games into training and validation data, the replay of a
+// recorded game, the fan-out over worker threads and the Adam optimizer.
+
+namespace training {
+
+// opens the record files at `paths`; a failure is reported
+inline bool open_records(const std::vector<const char *>& paths,
+                         std::vector<std::unique_ptr<GameRecordFile>>& files)
+{
+	files.clear();
+	for(const auto path : paths){
+		files.emplace_back(new GameRecordFile());
+		if(!files.back()->open(path)){
+			std::cerr << "failed to read " << path << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+// Calls `visit(game, held_out)` for the games of all files in order. The
+// last share `validation` of them, the last games of the last files, are
+// held out for validation, so they all come after the training games.
+template <typename Visit>
+void split_games(const std::vector<std::unique_ptr<GameRecordFile>>& files, double validation,
+                 const Visit& visit)
+{
+	size_t num_games = 0;
+	for(const auto& file : files){ num_games += file->size(); }
+	const size_t num_training = static_cast<size_t>(num_games * (1.0 - validation));
+	size_t index = 0;
+	for(const auto& file : files){
+		for(size_t i = 0; i < file->size(); ++i, ++index){
+			visit(file->game(i), index >= num_training);
+		}
+	}
+}
+
+// result of a game for black: 1 for a win, 0.5 for a draw
+inline double result_of(const GameRecordView& game){
+	return game.score() > 0 ? 1.0 : (game.score() < 0 ? 0.0 : 0.5);
+}
+
+// Replays `game`. `on_move(tracker, ply)` is called before every move and
+// `on_position(tracker, stats)` for every recorded decision, with the
+// tracker at that decision: a placement before the move of its ply, a
+// selection after it, while the cycle waits for its selection. The replay
+// stops at an illegal move.
+template <typename OnMove, typename OnPosition>
+void replay(const GameRecordView& game, const OnMove& on_move, const OnPosition& on_position){
+	GameTracker tracker;
+	int k = 0;
+	for(int ply = 0; ply < game.num_moves(); ++ply){
+		on_move(tracker, ply);
+		for(; k < game.num_positions() && game.position(k).ply <= ply; ++k){
+			const auto& stats = game.position(k);
+			if(stats.ply < ply){ continue; }
+			if(stats.kind != PositionStats::PLACEMENT){ break; }
+			on_position(tracker, stats);
+		}
+		const auto h = game.move(ply);
+		if(!tracker.play(h.p, h.q)){ return; }
+		for(; k < game.num_positions() && game.position(k).ply == ply; ++k){
+			const auto& stats = game.position(k);
+			if(stats.kind == PositionStats::SELECTION && tracker.has_pending()){
+				on_position(tracker, stats);
+			}
+		}
+		if(tracker.has_pending()){ tracker.select(h.select ? h.q : h.p); }
+	}
+}
+
+// replays `game` for its recorded decisions only
+template <typename OnPosition>
+void replay(const GameRecordView& game, const OnPosition& on_position){
+	replay(game, [](const GameTracker&, int){ }, on_position);
+}
+
+// Runs `body(thread, i, loss)` for every i in [begin, end) on `num_threads`
+// threads and returns the sum of their losses. Thread t takes every
+// num_threads-th index from begin + t, so the work of a thread does not
+// depend on the timing of the others.
+template <typename Loss, typename Body>
+Loss parallel_for(int num_threads, size_t begin, size_t end, const Body& body){
+	num_threads = std::max(1, num_threads);
+	std::vector<Loss> losses(num_threads);
+	std::vector<std::thread> threads;
+	for(int t = 0; t < num_threads; ++t){
+		threads.emplace_back([&, t]{
+			for(size_t i = begin + t; i < end; i += num_threads){ body(t, i, losses[t]); }
+		});
+	}
+	for(auto& t : threads){ t.join(); }
+	Loss total;
+	for(const auto& loss : losses){ total.add(loss); }
+	return total;
+}
+
+// Adam with the bias correction folded into the step size, over a flat
+// array of parameters of type T
+template <typename T>
+class Adam {
+
+private:
+	std::vector<T> m_first_moment;
+	std::vector<T> m_second_moment;
+	double m_learning_rate;
+	long long m_num_steps;
+
+public:
+	Adam(size_t num_parameters, double learning_rate)
+		: m_first_moment(num_parameters, T(0))
+		, m_second_moment(num_parameters, T(0))
+		, m_learning_rate(learning_rate)
+		, m_num_steps(0)
+	{ }
+
+	// moves `weights` against the gradient, of which `gradient(i)` returns
+	// component i averaged over the batch
+	template <typename Gradient>
+	void step(T *weights, const Gradient& gradient){
+		const T beta1 = T(0.9), beta2 = T(0.999), epsilon = T(1e-8);
+		++m_num_steps;
+		const T correction =
+			std::sqrt(T(1) - std::pow(beta2, static_cast<T>(m_num_steps))) /
+			(T(1) - std::pow(beta1, static_cast<T>(m_num_steps)));
+		const T rate = static_cast<T>(m_learning_rate) * correction;
+		T *m = m_first_moment.data();
+		T *v = m_second_moment.data();
+		for(size_t i = 0; i < m_first_moment.size(); ++i){
+			const T g = gradient(i);
+			m[i] = beta1 * m[i] + (T(1) - beta1) * g;
+			v[i] = beta2 * v[i] + (T(1) - beta2) * g * g;
+			weights[i] -= rate * m[i] / (std::sqrt(v[i]) + epsilon);
+		}
+	}
+
+};
+
+}